@@ -3,7 +3,36 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most sectors merged into a single transfer. */
+#define BLOCK_MERGE_MAX 32
+
+/* Request latencies are counted in buckets of 0 ticks, 1 tick,
+   2-3 ticks, 4-7 ticks, and so on, the last one open-ended. */
+#define BLOCK_LATENCY_BUCKETS 8
+
+/* Request statistics for a block device. */
+struct block_stats
+  {
+    /* Requests and sectors by class and direction (0: read,
+       1: write). */
+    unsigned long long requests[BLOCK_IO_CLASS_CNT][2];
+    unsigned long long sectors[BLOCK_IO_CLASS_CNT][2];
+
+    /* Requests by timer ticks from submission to completion. */
+    unsigned long long latency[BLOCK_LATENCY_BUCKETS];
+    unsigned long long total_ticks;     /* Sum of all latencies. */
+
+    /* Queue behavior, kept only on devices with no parent. */
+    unsigned long long transfers;       /* Driver calls made. */
+    unsigned long long merged;          /* Requests merged into another. */
+    unsigned long long depth_sum;       /* Sum of queue depths at submit. */
+    int depth;                          /* Requests queued now. */
+    int max_depth;                      /* Most requests ever queued. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +48,22 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* A partition queues its requests on the device that holds
+       it, starting at sector START there. */
+    struct block *parent;               /* Containing device, or null. */
+    block_sector_t start;               /* First sector in PARENT. */
+
+    /* Request queue, used only on devices with no parent. */
+    struct lock queue_lock;             /* Guards the members below. */
+    struct list queue;                  /* Pending requests by sector. */
+    bool busy;                          /* Is a thread serving QUEUE? */
+    struct condition served;            /* Requests completed, or BUSY
+                                           cleared. */
+    block_sector_t head;                /* Sector after the last transfer. */
+    uint8_t *bounce;                    /* Buffer for merged transfers. */
+
+    struct block_stats stats;           /* Request statistics. */
   };
 
 /* List of all block devices. */
@@ -28,6 +73,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void serve_queue (struct block *, struct block_request *);
+static void account_request (struct block_request *);
+static bool request_less (const struct list_elem *, const struct list_elem *,
+                          void *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +169,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +180,296 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Devices that support it do this as a single transfer.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, false, sector, buffer, cnt);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Devices that support it do this as a single transfer.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, true, sector, (void *) buffer, cnt);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to read or, if WRITE is true,
+   write CNT sectors starting at SECTOR, into or out of BUFFER.
+   R has no completion callback and no class; the caller may set
+   R->done, R->aux and R->class before submitting it. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, void *buffer, block_sector_t cnt)
+{
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->done = NULL;
+  r->aux = NULL;
+  r->class = BLOCK_IO_OTHER;
+  r->completed = false;
+}
+
+/* Queues R on BLOCK without starting it.  R is carried out once
+   some thread serves the queue; see block_wait() and
+   block_unplug(). */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  ASSERT (r->cnt > 0);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  if (r->class == BLOCK_IO_OTHER && block->type == BLOCK_SWAP)
+    r->class = BLOCK_IO_SWAP;
+  r->origin = block;
+  r->submitted = timer_ticks ();
+
+  /* Account the request to every device it passes through, then
+     hand it to the device that holds them all. */
+  for (;;)
+    {
+      if (r->write)
+        block->write_cnt += r->cnt;
+      else
+        block->read_cnt += r->cnt;
+      if (block->parent == NULL)
+        break;
+      r->sector += block->start;
+      block = block->parent;
+    }
+
+  r->block = block;
+  lock_acquire (&block->queue_lock);
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  block->stats.depth_sum += block->stats.depth++;
+  if (block->stats.depth > block->stats.max_depth)
+    block->stats.max_depth = block->stats.depth;
+  lock_release (&block->queue_lock);
+}
+
+/* Serves the queue of BLOCK, or of the device that holds it,
+   until it is empty, unless another thread is already doing so. */
+void
+block_unplug (struct block *block)
+{
+  while (block->parent != NULL)
+    block = block->parent;
+
+  lock_acquire (&block->queue_lock);
+  if (!block->busy)
+    {
+      block->busy = true;
+      serve_queue (block, NULL);
+      block->busy = false;
+      cond_broadcast (&block->served, &block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for R, which must have been submitted without a
+   completion callback, to complete.  Meanwhile serves its
+   device's queue, if no other thread is, but only until R is
+   done: the caller may hold locks others are waiting on, so it
+   then leaves the rest to the next waiting thread. */
+void
+block_wait (struct block_request *r)
+{
+  struct block *block = r->block;
+
+  ASSERT (r->done == NULL);
+  lock_acquire (&block->queue_lock);
+  while (!r->completed)
+    if (!block->busy)
+      {
+        block->busy = true;
+        serve_queue (block, r);
+        block->busy = false;
+        cond_broadcast (&block->served, &block->queue_lock);
+      }
+    else
+      cond_wait (&block->served, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Orders requests by ascending first sector.  Requests for the
+   same sector stay in the order they were submitted. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Removes from BLOCK's queue the next request in C-LOOK order,
+   which is the first at or past the sector the last transfer
+   ended at or, if there is none, the lowest.  Also removes the
+   requests in the same direction that continue it without a
+   gap, up to BLOCK_MERGE_MAX sectors in all, and moves them all
+   to BATCH.  Returns the number of sectors in BATCH. */
+static block_sector_t
+next_batch (struct block *block, struct list *batch)
+{
+  struct list_elem *e;
+  struct block_request *first, *r;
+  block_sector_t cnt;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+
+  first = list_entry (e, struct block_request, elem);
+  cnt = first->cnt;
+  e = list_remove (e);
+  list_push_back (batch, &first->elem);
+  while (e != list_end (&block->queue) && block->bounce != NULL)
+    {
+      r = list_entry (e, struct block_request, elem);
+      if (r->write != first->write || r->sector != first->sector + cnt
+          || cnt + r->cnt > BLOCK_MERGE_MAX)
+        break;
+      cnt += r->cnt;
+      e = list_remove (e);
+      list_push_back (batch, &r->elem);
+    }
+  return cnt;
+}
+
+/* Carries out CNT sectors of transfer at SECTOR on BLOCK, from or
+   into BUFFER. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          uint8_t *buffer, block_sector_t cnt)
+{
+  block_sector_t i;
+
+  if (write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, buffer, cnt);
+  else if (!write && block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        if (write)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+        else
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+      }
+}
+
+/* Carries out the requests queued on BLOCK, one merged batch at
+   a time, until the queue is empty or, if UNTIL is non-null,
+   UNTIL has completed.  Must be called with BLOCK's queue lock
+   held and BLOCK marked busy; the lock is dropped during each
+   transfer so that other threads can keep queuing. */
+static void
+serve_queue (struct block *block, struct block_request *until)
+{
+  if (block->bounce == NULL)
+    block->bounce = malloc (BLOCK_MERGE_MAX * BLOCK_SECTOR_SIZE);
+
+  while (!list_empty (&block->queue)
+         && (until == NULL || !until->completed))
+    {
+      struct list batch;
+      struct block_request *first;
+      struct list_elem *e;
+      block_sector_t cnt;
+      size_t ofs;
+
+      list_init (&batch);
+      cnt = next_batch (block, &batch);
+      first = list_entry (list_front (&batch), struct block_request, elem);
+      block->head = first->sector + cnt;
+      block->stats.depth -= list_size (&batch);
+      block->stats.merged += list_size (&batch) - 1;
+      block->stats.transfers++;
+      lock_release (&block->queue_lock);
+
+      if (cnt == first->cnt)
+        transfer (block, first->write, first->sector, first->buffer, cnt);
+      else
+        {
+          /* Gather into, or scatter out of, the bounce buffer. */
+          if (first->write)
+            for (ofs = 0, e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r = list_entry (e, struct block_request,
+                                                      elem);
+                memcpy (block->bounce + ofs, r->buffer,
+                        r->cnt * BLOCK_SECTOR_SIZE);
+                ofs += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          transfer (block, first->write, first->sector, block->bounce, cnt);
+          if (!first->write)
+            for (ofs = 0, e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r = list_entry (e, struct block_request,
+                                                      elem);
+                memcpy (r->buffer, block->bounce + ofs,
+                        r->cnt * BLOCK_SECTOR_SIZE);
+                ofs += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* Complete the batch.  A callback may free its request, and
+         so may a waiter once its request is marked completed. */
+      lock_acquire (&block->queue_lock);
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          account_request (r);
+          if (r->done != NULL)
+            {
+              lock_release (&block->queue_lock);
+              r->done (r);
+              lock_acquire (&block->queue_lock);
+            }
+          else
+            r->completed = true;
+        }
+      cond_broadcast (&block->served, &block->queue_lock);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,7 +493,73 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Records completed request R in the statistics of the device
+   it was submitted to and of every device that contains that
+   one.  Called only by the thread serving R's queue. */
+static void
+account_request (struct block_request *r)
+{
+  int64_t ticks = timer_ticks () - r->submitted;
+  int bucket = 0;
+  struct block *block;
+
+  while (bucket < BLOCK_LATENCY_BUCKETS - 1 && ticks >= (1 << bucket))
+    bucket++;
+  for (block = r->origin; block != NULL; block = block->parent)
+    {
+      struct block_stats *s = &block->stats;
+
+      s->requests[r->class][r->write]++;
+      s->sectors[r->class][r->write] += r->cnt;
+      s->latency[bucket]++;
+      s->total_ticks += ticks;
+    }
+}
+
+/* Prints the detailed request statistics of BLOCK. */
+static void
+print_detailed_stats (struct block *block)
+{
+  static const char *class_names[BLOCK_IO_CLASS_CNT] =
+    {"other", "data", "metadata", "free map", "swap"};
+  const struct block_stats *s = &block->stats;
+  unsigned long long cnt = 0;
+  int i;
+
+  for (i = 0; i < BLOCK_IO_CLASS_CNT; i++)
+    if (s->requests[i][0] + s->requests[i][1] > 0)
+      {
+        printf ("  %-9s %llu reads (%llu bytes), %llu writes (%llu bytes)\n",
+                class_names[i],
+                s->requests[i][0], s->sectors[i][0] * BLOCK_SECTOR_SIZE,
+                s->requests[i][1], s->sectors[i][1] * BLOCK_SECTOR_SIZE);
+        cnt += s->requests[i][0] + s->requests[i][1];
+      }
+  if (cnt == 0)
+    return;
+
+  printf ("  latency (ticks):");
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (i == 0)
+      printf (" 0: %llu", s->latency[i]);
+    else if (i == 1)
+      printf (", 1: %llu", s->latency[i]);
+    else if (i < BLOCK_LATENCY_BUCKETS - 1)
+      printf (", %d-%d: %llu", 1 << (i - 1), (1 << i) - 1, s->latency[i]);
+    else
+      printf (", %d+: %llu", 1 << (i - 1), s->latency[i]);
+  printf ("; mean %llu.%02llu\n", s->total_ticks / cnt,
+          s->total_ticks * 100 / cnt % 100);
+
+  if (block->parent == NULL && s->transfers > 0)
+    printf ("  queue: %llu transfers, %llu merged, "
+            "max depth %d, mean depth %llu.%02llu\n",
+            s->transfers, s->merged, s->max_depth,
+            s->depth_sum / cnt, s->depth_sum * 100 / cnt % 100);
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   and for the device holding each one that is a partition. */
 void
 block_print_stats (void)
 {
@@ -174,6 +573,12 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_detailed_stats (block);
+          if (block->parent != NULL)
+            {
+              printf (" on %s:\n", block->parent->name);
+              print_detailed_stats (block->parent);
+            }
         }
     }
 }
@@ -200,6 +605,15 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->parent = NULL;
+  block->start = 0;
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  block->busy = false;
+  cond_init (&block->served);
+  block->head = 0;
+  block->bounce = NULL;
+  memset (&block->stats, 0, sizeof block->stats);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +625,18 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Makes BLOCK, which lies within PARENT starting at sector
+   START, queue its requests on PARENT, so that requests to all
+   partitions of a disk are scheduled together. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (start + block->size <= parent->size);
+  block->parent = parent;
+  block->start = start;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
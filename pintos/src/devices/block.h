@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +56,60 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* What a request is for, for statistics. */
+enum block_io_class
+  {
+    BLOCK_IO_OTHER,              /* Not classified by the caller. */
+    BLOCK_IO_DATA,               /* File data. */
+    BLOCK_IO_META,               /* Inodes, extent blocks, directories. */
+    BLOCK_IO_FREE_MAP,           /* Free map. */
+    BLOCK_IO_SWAP,               /* Swapped-out pages. */
+    BLOCK_IO_CLASS_CNT
+  };
+
+/* Asynchronous requests.
+
+   block_submit() only queues a request.  The queue is served,
+   in an order that keeps the disk head sweeping in one
+   direction and with requests for adjacent sectors merged, by
+   the first thread to call block_wait() or block_unplug() while
+   no one else is serving it; so a caller that submits a burst of
+   requests before waiting lets them be sorted and merged
+   together.  A thread in block_wait() serves only until its own
+   request completes, then hands the queue to another waiting
+   thread.  When a request completes, DONE is called if it is
+   non-null; otherwise block_wait() returns.  Either way this
+   happens in the serving thread, not in an interrupt handler.
+   Requests that overlap may complete in any order. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    struct block *origin;               /* Device submitted to. */
+    struct block *block;                /* Device queued on. */
+    enum block_io_class class;          /* Purpose, for statistics. */
+    int64_t submitted;                  /* Timer tick when submitted. */
+    bool write;                         /* Write or read? */
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    void (*done) (struct block_request *); /* Completion callback. */
+    void *aux;                          /* For use by DONE. */
+    bool completed;                     /* Done yet?  Only set if no DONE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, void *buffer, block_sector_t cnt);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+void block_unplug (struct block *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +119,19 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors at once.  May be null, in
+       which case the sectors are transferred one at a time. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
 
 #endif /* devices/block.h */
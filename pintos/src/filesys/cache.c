@@ -1,171 +1,529 @@
 #include "filesys/cache.h"
 #include <debug.h>
-#include <list.h>
 #include <hash.h>
+#include <stdlib.h>
 #include <string.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "devices/block.h"
-#include "threads/malloc.h"
+#include "devices/timer.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 #define CACHE_MAX 64
 
+/* Second chances given to a slot on access.  Metadata sectors
+   (inodes, index blocks, directories, the free map) get more of
+   them, and on top of that are passed over by the clock hand as
+   long as file data is cached and metadata holds no more than
+   CACHE_META_MAX slots, so a sequential scan of a large file only
+   replaces other file data, while file data always keeps a share
+   of the cache. */
+#define CACHE_USAGE_DATA 1
+#define CACHE_USAGE_META 3
+#define CACHE_META_MAX (CACHE_MAX * 3 / 4)
+
 struct cache_entry
 {
 	struct hash_elem hash_elem;
-	struct list_elem list_elem;
 	int sector_idx;
-	void *data;
+	bool in_use;                /* Slot holds a valid sector? */
+	bool dirty;                 /* Modified since last written to disk? */
+	int usage;                  /* Clock chances left before eviction. */
+	enum cache_type type;       /* What the sector holds. */
+	struct lock lock;           /* Guards DATA and DIRTY. */
+	struct block_request io;    /* For asynchronous write-back. */
+	uint8_t data[BLOCK_SECTOR_SIZE];
 };
 
-struct buffer_cache
-{
-	struct hash *hash;
-	struct list list;
-	int cnt;
-};
+/* Statically allocated cache slots and the clock hand that
+   sweeps over them. */
+static struct cache_entry slots[CACHE_MAX];
+static int clock_hand;
+static int data_cnt;            /* Slots in use holding CACHE_DATA... */
+static int meta_cnt;            /* ...and holding anything else. */
+
+/* Maps sector numbers to the slot holding them.  CACHE_LOCK
+   guards the map, the clock hand, DATA_CNT, META_CNT and each
+   slot's SECTOR_IDX, IN_USE, USAGE and TYPE, and is only held
+   briefly; disk I/O and copying happen under the slot's own
+   lock, so accesses to different sectors proceed in parallel.
+
+   Lock order: CACHE_LOCK, then a slot lock.  A thread holding a
+   slot lock never waits for CACHE_LOCK. */
+static struct hash cache_map;
+static struct lock cache_lock;
+
+/* Sectors waiting to be prefetched by the read-ahead daemon, as
+   a ring buffer.  Requests that find the queue full are
+   dropped; read-ahead is only a hint. */
+#define READ_AHEAD_MAX 32
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static int read_ahead_head;
+static int read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond;
+
+static void read_ahead_daemon (void *);
 
-struct buffer_cache *cache;
-struct lock cache_lock;
+/* Timer ticks between passes of the write-behind daemon, which
+   bounds how long a dirty sector may stay only in memory.
+   Controlled by kernel command-line option "-wb=TICKS"; 0
+   disables the daemon. */
+int64_t cache_write_behind_ticks = TIMER_FREQ;
+
+/* Set to ask the write-behind daemon to exit, which it signals
+   by upping WRITE_BEHIND_DONE. */
+static bool write_behind_running;
+static volatile bool write_behind_stop;
+static struct semaphore write_behind_done;
+
+static void write_behind_daemon (void *);
 
-void cache_destroyer (struct hash_elem *, void *);
 unsigned cache_hash (const struct hash_elem *, void *);
 bool cache_less (const struct hash_elem *, const struct hash_elem *, void *);
-void cache_delete (int sector_idx);
+static void cache_write_back (struct cache_entry *);
+static struct cache_entry *cache_evict (void);
+static struct cache_entry *cache_insert (block_sector_t, enum cache_type);
+static struct cache_entry *cache_find (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool, enum cache_type);
+
 void
 cache_init()
 {
-	cache = malloc(sizeof(struct buffer_cache));
-	if (cache == NULL)
-		PANIC ("buffer_cache_init: memory allocation failed (cache)");
+	int i;
 
-	cache->hash = malloc(sizeof(struct hash));
-	if (cache->hash == NULL)
-		PANIC ("buffer_cache_init: memory allocation failed (hash)");
-	if (!hash_init(cache->hash, cache_hash, cache_less, NULL))
+	if (!hash_init(&cache_map, cache_hash, cache_less, NULL))
 		PANIC ("buffer_cache_init: hash init failed");
-	
-	list_init(&cache->list);
-	cache->cnt = 0;
+
+	for (i = 0; i < CACHE_MAX; i++) {
+		slots[i].in_use = false;
+		lock_init (&slots[i].lock);
+	}
+	clock_hand = 0;
+	data_cnt = meta_cnt = 0;
 
 	lock_init(&cache_lock);
+
+	read_ahead_head = 0;
+	read_ahead_cnt = 0;
+	lock_init (&read_ahead_lock);
+	cond_init (&read_ahead_cond);
+	sema_init (&write_behind_done, 0);
 }
 
+/* Starts the cache's kernel threads.  Must be called once the
+   file system is mounted, since new threads open the root
+   directory. */
 void
-cache_close ()
+cache_daemon_init ()
 {
-	hash_destroy (cache->hash, cache_destroyer);
-	free (cache->hash);
-	free (cache);
+	thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+	if (cache_write_behind_ticks > 0)
+		write_behind_running = thread_create ("write-behind", PRI_DEFAULT,
+		                                      write_behind_daemon, NULL) != TID_ERROR;
 }
 
+/* Stops the write-behind daemon and waits for it to finish its
+   current pass, if it is in one, so that nothing else writes to
+   the free map file or the cache while the file system shuts
+   down.  A sleeping daemon notices right away. */
 void
-cache_destroyer (struct hash_elem *e, void *aux)
+cache_daemon_stop ()
 {
-	struct cache_entry *entry = hash_entry (e, struct cache_entry, hash_elem);
-	block_write(fs_device, entry->sector_idx, entry->data);
+	if (!write_behind_running)
+		return;
+	write_behind_stop = true;
+	sema_down (&write_behind_done);
+	write_behind_running = false;
 }
 
-void *
-cache_insert (int sector_idx)
+/* Writes every dirty sector back to disk and empties the cache. */
+void
+cache_close ()
 {
-	struct cache_entry *entry;
+	int i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_MAX; i++) {
+		lock_acquire (&slots[i].lock);
+		if (slots[i].in_use) {
+			cache_write_back (&slots[i]);
+			slots[i].in_use = false;
+		}
+		lock_release (&slots[i].lock);
+	}
+	hash_clear (&cache_map, NULL);
+	data_cnt = meta_cnt = 0;
+	lock_release (&cache_lock);
+}
+
+/* Starts reading or writing ENTRY's sector, tagged with what it
+   holds for the block layer's statistics.  The caller must hold
+   ENTRY's lock until block_wait() on ENTRY->io returns. */
+static void
+cache_submit (struct cache_entry *entry, bool write)
+{
+	static const enum block_io_class classes[] =
+		{BLOCK_IO_DATA, BLOCK_IO_META, BLOCK_IO_FREE_MAP};
+
+	block_request_init (&entry->io, write, entry->sector_idx, entry->data, 1);
+	entry->io.class = classes[entry->type];
+	block_submit (fs_device, &entry->io);
+}
+
+/* Reads or writes ENTRY's sector and waits for it to finish. */
+static void
+cache_io (struct cache_entry *entry, bool write)
+{
+	cache_submit (entry, write);
+	block_wait (&entry->io);
+}
+
+/* Writes ENTRY to disk if it has been modified since it was
+   last written.  The caller must hold ENTRY's lock. */
+static void
+cache_write_back (struct cache_entry *entry)
+{
+	if (entry->dirty) {
+		cache_io (entry, true);
+		entry->dirty = false;
+	}
+}
+
+/* Adds DELTA to the count of slots in use holding ENTRY's type
+   of sector.  Must be called with CACHE_LOCK held. */
+static void
+cache_count (const struct cache_entry *entry, int delta)
+{
+	if (entry->type == CACHE_DATA)
+		data_cnt += delta;
+	else
+		meta_cnt += delta;
+}
+
+/* Advances the clock hand until it finds a free slot or one whose
+   chances have run out, and returns it, no longer mapped and with
+   its lock held.  Slots whose lock is held are being read or
+   written and are skipped.  Metadata slots are skipped too, as
+   long as a file data slot is cached and metadata holds no more
+   than CACHE_META_MAX slots; once the hand has gone around often
+   enough that every unlocked data slot would have been taken,
+   metadata is no longer spared.  Must be called with CACHE_LOCK
+   held.
+
+   A dirty victim is not evicted directly.  It stays mapped, so no
+   one reads the stale copy on disk, while CACHE_LOCK is released
+   and it is written back under its own lock; then a null pointer
+   is returned, and the caller must start over without CACHE_LOCK.
+   The victim, now clean, is usually taken on the next try. */
+static struct cache_entry *
+cache_evict ()
+{
+	struct cache_entry *victim;
+	int steps;
+
+	for (steps = 0; ; steps++) {
+		victim = &slots[clock_hand];
+		clock_hand = (clock_hand + 1) % CACHE_MAX;
+
+		if (!lock_try_acquire (&victim->lock))
+			continue;
+		if (!victim->in_use)
+			return victim;
+		if (victim->type != CACHE_DATA && data_cnt > 0
+		    && meta_cnt <= CACHE_META_MAX
+		    && steps < CACHE_MAX * (CACHE_USAGE_DATA + 2)) {
+			lock_release (&victim->lock);
+			continue;
+		}
+		if (victim->usage > 0) {
+			victim->usage--;
+			lock_release (&victim->lock);
+			continue;
+		}
+		if (victim->dirty) {
+			lock_release (&cache_lock);
+			cache_write_back (victim);
+			lock_release (&victim->lock);
+			return NULL;
+		}
+		hash_delete (&cache_map, &victim->hash_elem);
+		victim->in_use = false;
+		cache_count (victim, -1);
+		return victim;
+	}
+}
+
+/* Maps SECTOR_IDX to a slot, evicting one chosen by the clock if
+   the cache is full, and returns the slot with its lock held.
+   The caller must fill in the data before releasing the lock.
+   Data sectors start with no second chance until they are
+   accessed again; metadata sectors start fully protected.  Must
+   be called with CACHE_LOCK held.  Returns a null pointer, with
+   CACHE_LOCK released, if a victim had to be written back first;
+   the caller must then look SECTOR_IDX up again. */
+static struct cache_entry *
+cache_insert (block_sector_t sector_idx, enum cache_type type)
+{
+	struct cache_entry *entry = cache_evict ();
 
-	entry = malloc(sizeof(struct cache_entry));
 	if (entry == NULL)
-		PANIC ("cache_insert: memory allocation failed (cache_entry)");
+		return NULL;
 
 	entry->sector_idx = sector_idx;
-	entry->data = malloc(BLOCK_SECTOR_SIZE);
-	if (entry->data == NULL)
-		PANIC ("cache_insert: memory allocation failed (data)");
-
-	if (cache->cnt >= CACHE_MAX) {
-		struct cache_entry *victim = list_entry(list_pop_front(&cache->list), struct cache_entry, list_elem);
-		hash_delete (cache->hash, &victim->hash_elem);
-		free (victim->data);
-		free (victim);
-		cache->cnt--;
-	}
-	block_read (fs_device, sector_idx, entry->data);
-	//printf("cache insert, what is in that sector? : %d\n", sector_idx);
-	//hex_dump (0, entry->data, BLOCK_SECTOR_SIZE, true);
-	list_push_back(&cache->list, &entry->list_elem);
-	hash_insert(cache->hash, &entry->hash_elem);
-	cache->cnt++;
+	entry->in_use = true;
+	entry->dirty = false;
+	entry->usage = type != CACHE_DATA ? CACHE_USAGE_META : 0;
+	entry->type = type;
+	cache_count (entry, 1);
+	hash_insert(&cache_map, &entry->hash_elem);
 
 	return entry;
 }
 
-void *
-cache_find (int sector_idx)
+/* Returns the slot holding SECTOR_IDX, or a null pointer.  Must
+   be called with CACHE_LOCK held. */
+static struct cache_entry *
+cache_find (block_sector_t sector_idx)
 {
-	struct cache_entry entry;
+	static struct cache_entry key;  /* Too big for the stack; guarded
+	                                   by CACHE_LOCK. */
 	struct hash_elem *e;
 
-	entry.sector_idx = sector_idx;
-	e = hash_find (cache->hash, &entry.hash_elem);
+	key.sector_idx = sector_idx;
+	e = hash_find (&cache_map, &key.hash_elem);
 
 	return e != NULL ? hash_entry(e, struct cache_entry, hash_elem) : NULL;
 }
 
+/* Gives ENTRY the second chances due to an access
+   of the given TYPE. */
+static void
+cache_touch (struct cache_entry *entry, enum cache_type type)
+{
+	int usage = type != CACHE_DATA ? CACHE_USAGE_META : CACHE_USAGE_DATA;
+	if (entry->usage < usage)
+		entry->usage = usage;
+}
+
+/* Returns the slot holding SECTOR_IDX with its lock held,
+   bringing the sector in first if it is not cached.  If READ is
+   false the caller is about to overwrite the whole sector, so the
+   disk read is skipped.  A slot found in the map may be evicted
+   between dropping CACHE_LOCK and taking its lock, in which case
+   the lookup starts over. */
+static struct cache_entry *
+cache_get (block_sector_t sector_idx, bool read, enum cache_type type)
+{
+	struct cache_entry *entry;
+
+	for (;;) {
+		lock_acquire (&cache_lock);
+		entry = cache_find (sector_idx);
+		if (entry == NULL) {
+			entry = cache_insert (sector_idx, type);
+			if (entry == NULL)
+				continue;
+			lock_release (&cache_lock);
+			if (read)
+				cache_io (entry, false);
+			return entry;
+		}
+		cache_touch (entry, type);
+		lock_release (&cache_lock);
+
+		lock_acquire (&entry->lock);
+		if (entry->in_use && entry->sector_idx == (int) sector_idx)
+			return entry;
+		lock_release (&entry->lock);
+	}
+}
+
+/* Reads CHUNK_SIZE bytes at SECTOR_OFS within SECTOR_IDX into
+   BUFFER, going through the cache.  TYPE tells the eviction
+   policy whether the sector holds file data or metadata. */
 void
-cache_read (void *p, void *buffer, off_t sector_ofs, int chunk_size)
+cache_read_at (block_sector_t sector_idx, void *buffer, off_t sector_ofs, int chunk_size,
+               enum cache_type type)
 {
-	struct cache_entry *entry = (struct cache_entry *)p;
+	struct cache_entry *entry = cache_get (sector_idx, true, type);
+
 	memcpy (buffer, entry->data + sector_ofs, chunk_size);
-	//printf("cache_read : %p\n", entry->data + sector_ofs);
-	//hex_dump (0, entry->data + sector_ofs, chunk_size, true);
+	lock_release (&entry->lock);
 }
 
+/* Writes CHUNK_SIZE bytes from BUFFER at SECTOR_OFS within
+   SECTOR_IDX, going through the cache.  The sector is only
+   marked dirty; it reaches the disk when it is evicted or the
+   cache is flushed. */
 void
-cache_write (void *p, void *buffer, off_t sector_ofs, int chunk_size)
+cache_write_at (block_sector_t sector_idx, const void *buffer, off_t sector_ofs, int chunk_size,
+                enum cache_type type)
 {
-	struct cache_entry *entry = (struct cache_entry *)p;
+	struct cache_entry *entry = cache_get (sector_idx, chunk_size < BLOCK_SECTOR_SIZE, type);
+
 	memcpy (entry->data + sector_ofs, buffer, chunk_size);
-	block_write (fs_device, entry->sector_idx, entry->data);
-	//printf("sector_idx %d\n", entry->sector_idx);
-	//hex_dump(0, entry->data, 0x30, true);
+	entry->dirty = true;
+	lock_release (&entry->lock);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR_IDX into the cache
+   in the background.  Returns immediately. */
+void
+cache_read_ahead (block_sector_t sector_idx)
+{
+	lock_acquire (&read_ahead_lock);
+	if (read_ahead_cnt < READ_AHEAD_MAX) {
+		read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_MAX] = sector_idx;
+		read_ahead_cnt++;
+		cond_signal (&read_ahead_cond, &read_ahead_lock);
+	}
+	lock_release (&read_ahead_lock);
+}
+
+/* Pulls sectors off the read-ahead queue and loads each one that
+   is not already cached. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+	for (;;) {
+		block_sector_t sector_idx;
+
+		lock_acquire (&read_ahead_lock);
+		while (read_ahead_cnt == 0)
+			cond_wait (&read_ahead_cond, &read_ahead_lock);
+		sector_idx = read_ahead_queue[read_ahead_head];
+		read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+		read_ahead_cnt--;
+		lock_release (&read_ahead_lock);
+
+		for (;;) {
+			struct cache_entry *entry;
+
+			lock_acquire (&cache_lock);
+			if (cache_find (sector_idx) != NULL) {
+				lock_release (&cache_lock);
+				break;
+			}
+			entry = cache_insert (sector_idx, CACHE_DATA);
+			if (entry != NULL) {
+				lock_release (&cache_lock);
+				cache_io (entry, false);
+				lock_release (&entry->lock);
+				break;
+			}
+		}
+	}
+}
+
+/* Orders cache slots by ascending sector number. */
+static int
+cache_sector_cmp (const void *a_, const void *b_)
+{
+	const struct cache_entry *a = *(struct cache_entry * const *) a_;
+	const struct cache_entry *b = *(struct cache_entry * const *) b_;
+
+	return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Writes every dirty sector in the cache back to disk, keeping
+   the sectors cached.  All the writes are queued before any is
+   waited for, so the block layer can sort them and merge runs of
+   adjacent sectors.  Slot locks are taken in ascending sector
+   order and held until each write completes; CACHE_LOCK is held
+   only while choosing the slots. */
+void
+cache_flush ()
+{
+	struct cache_entry *dirty[CACHE_MAX];
+	size_t cnt = 0, i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_MAX; i++)
+		if (slots[i].in_use && slots[i].dirty)
+			dirty[cnt++] = &slots[i];
+	qsort (dirty, cnt, sizeof *dirty, cache_sector_cmp);
+	lock_release (&cache_lock);
+
+	for (i = 0; i < cnt; i++) {
+		struct cache_entry *e = dirty[i];
+
+		lock_acquire (&e->lock);
+		if (e->in_use && e->dirty)
+			cache_submit (e, true);
+		else {
+			lock_release (&e->lock);
+			dirty[i] = NULL;
+		}
+	}
+	for (i = 0; i < cnt; i++)
+		if (dirty[i] != NULL) {
+			block_wait (&dirty[i]->io);
+			dirty[i]->dirty = false;
+			lock_release (&dirty[i]->lock);
+		}
+}
+
+/* Sleeps for cache_write_behind_ticks timer ticks, the way
+   timer_sleep() does, but wakes up early once the daemon is
+   asked to stop. */
+static void
+write_behind_sleep (void)
+{
+	int64_t start = timer_ticks ();
+
+	while (!write_behind_stop && timer_elapsed (start) < cache_write_behind_ticks)
+		thread_yield ();
+}
+
+/* Flushes the free map and then the cache every
+   cache_write_behind_ticks timer ticks. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+	for (;;) {
+		write_behind_sleep ();
+		if (write_behind_stop)
+			break;
+		free_map_flush ();
+		cache_flush ();
+	}
+	sema_up (&write_behind_done);
 }
 
 unsigned
-cache_hash (const struct hash_elem *e, void *aux)
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
 {
 	const struct cache_entry *p = hash_entry(e, struct cache_entry, hash_elem);
-	return hash_bytes(&p->sector_idx, sizeof(void *)); 
+	return hash_int(p->sector_idx);
 }
 
 bool
-cache_less (const struct hash_elem *a, const struct hash_elem *b, void *aux)
+cache_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
 {
 	const struct cache_entry *a_ = hash_entry(a, struct cache_entry, hash_elem);
 	const struct cache_entry *b_ = hash_entry(b, struct cache_entry, hash_elem);
-	
+
 	return a_->sector_idx < b_->sector_idx;
 }
 
+/* Drops SECTOR_IDX from the cache without writing it back.
+   Used when the sector is released to the free map, so its
+   contents no longer matter. */
 void
-cache_delete (int sector_idx)
+cache_delete (block_sector_t sector_idx)
 {
 	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
 	e = cache_find (sector_idx);
 	if (e != NULL) {
-		//hex_dump (e->data, e->data, 40, true);
-		block_write (fs_device, e->sector_idx, e->data);
-		hash_delete (cache->hash, &e->hash_elem);
-		free (e->data);
-		free (e);
-		cache->cnt--;
+		lock_acquire (&e->lock);
+		hash_delete (&cache_map, &e->hash_elem);
+		e->in_use = false;
+		cache_count (e, -1);
+		lock_release (&e->lock);
 	}
-}
-void
-cache_lock_acquire ()
-{
-	lock_acquire(&cache_lock);
-}
-
-void
-cache_lock_release ()
-{
-	lock_release(&cache_lock);
+	lock_release (&cache_lock);
 }
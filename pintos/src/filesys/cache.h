@@ -1,13 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
 #include "filesys/off_t.h"
+#include "devices/block.h"
+
+/* What a cached sector holds.  Metadata, including the free
+   map, is kept resident longer than file data. */
+enum cache_type
+  {
+    CACHE_DATA,                 /* Regular file data. */
+    CACHE_META,                 /* Inodes, index blocks, directories. */
+    CACHE_FREE_MAP              /* Free map. */
+  };
+
+/* Write-behind interval in timer ticks ("-wb=TICKS"). */
+extern int64_t cache_write_behind_ticks;
 
 void cache_init(void);
+void cache_daemon_init(void);
+void cache_daemon_stop(void);
 void cache_close(void);
+void cache_flush(void);
+
+void cache_delete (block_sector_t);
 
-void *cache_insert (int);
-void *cache_find (int);
-void cache_read (void *, void *, off_t, int);
-void cache_write (void *, void *, off_t, int);
-void cache_delete (int);
+void cache_read_at (block_sector_t, void *, off_t, int, enum cache_type);
+void cache_write_at (block_sector_t, const void *, off_t, int, enum cache_type);
+void cache_read_ahead (block_sector_t);
 
-void cache_lock_acquire(void);
-void cache_lock_release(void);
+#endif /* filesys/cache.h */
@@ -0,0 +1,158 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Maximum number of cached names. */
+#define DCACHE_MAX 256
+
+/* A cached directory entry: NAME in the directory whose inode is
+   in sector DIR resolves to the inode in SECTOR, or does not
+   exist if SECTOR is DCACHE_NEGATIVE. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem list_elem;         /* Element in lru or free list. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* Inode sector or DCACHE_NEGATIVE. */
+  };
+
+static struct dentry pool[DCACHE_MAX];  /* Statically allocated entries. */
+static struct hash dentries;            /* Entries by (dir, name). */
+static struct list lru;                 /* In use, least recently used first. */
+static struct list free_dentries;       /* Not in use. */
+static struct lock dcache_lock;
+
+static unsigned dentry_hash (const struct hash_elem *, void *);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+                         void *);
+static struct dentry *dentry_find (block_sector_t, const char *);
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  list_init (&free_dentries);
+  for (i = 0; i < DCACHE_MAX; i++)
+    list_push_back (&free_dentries, &pool[i].list_elem);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in directory DIR.  Returns false if nothing is
+   cached.  Otherwise stores the inode sector, or DCACHE_NEGATIVE
+   if NAME is known not to exist, in *SECTORP and returns true. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->list_elem);
+      list_push_back (&lru, &d->list_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR resolves to SECTOR, which
+   may be DCACHE_NEGATIVE.  Replaces any older entry, evicting the
+   least recently used one if the cache is full. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    list_remove (&d->list_elem);
+  else
+    {
+      if (list_empty (&free_dentries))
+        {
+          struct dentry *victim = list_entry (list_front (&lru),
+                                              struct dentry, list_elem);
+          hash_delete (&dentries, &victim->hash_elem);
+          list_remove (&victim->list_elem);
+          list_push_back (&free_dentries, &victim->list_elem);
+        }
+      d = list_entry (list_pop_front (&free_dentries), struct dentry, list_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_back (&lru, &d->list_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Drops every entry for names in directory DIR, for when DIR is
+   deleted and its sector may be reused. */
+void
+dcache_purge (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, list_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        {
+          hash_delete (&dentries, &d->hash_elem);
+          list_remove (&d->list_elem);
+          list_push_back (&free_dentries, &d->list_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer. */
+static struct dentry *
+dentry_find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -0,0 +1,15 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Cached result for a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name, block_sector_t *);
+void dcache_insert (block_sector_t dir, const char *name, block_sector_t);
+void dcache_purge (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
@@ -1,7 +1,10 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
+#include "filesys/dcache.h"
 #include "filesys/inode.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
@@ -23,13 +26,64 @@ struct dir_entry
 		bool is_dir;
   };
 
+/* Directories are hash tables on disk.  Each sector of the
+   directory file is a bucket of DIR_BUCKET_ENTRIES entries, and a
+   name lives in the bucket its hash selects or, if that one is
+   full, in one of the next few buckets.  An entry that is not in
+   use and has an empty name has never been used, and ends the
+   probe sequence; removed entries keep their name. */
+#define DIR_BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Buckets dir_add() looks at before it doubles the table. */
+#define DIR_MAX_PROBE 4
+
+/* Returns the number of buckets in DIR's hash table. */
+static size_t
+dir_buckets (const struct dir *dir)
+{
+  size_t buckets = DIV_ROUND_UP (inode_length (dir->inode), BLOCK_SECTOR_SIZE);
+  return buckets > 0 ? buckets : 1;
+}
+
+/* Reads bucket B of DIR into ENTRIES.  Any part past the end of
+   the directory reads as never-used entries. */
+static void
+read_bucket (const struct dir *dir, size_t b, struct dir_entry *entries)
+{
+  off_t ofs = b * BLOCK_SECTOR_SIZE;
+  off_t n = inode_read_at (dir->inode, entries, BLOCK_SECTOR_SIZE, ofs);
+  memset ((uint8_t *) entries + n, 0, BLOCK_SECTOR_SIZE - n);
+}
+
+/* Returns true if DIR has no entries in use, reading one bucket
+   at a time into ENTRIES, a caller-provided buffer of
+   BLOCK_SECTOR_SIZE bytes. */
+static bool
+is_empty (const struct dir *dir, struct dir_entry *entries)
+{
+  size_t buckets = dir_buckets (dir), b, i;
+
+  for (b = 0; b < buckets; b++)
+    {
+      read_bucket (dir, b, entries);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (entries[i].in_use)
+          return false;
+    }
+  return true;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 
 bool
 dir_create (block_sector_t sector, size_t entry_cnt, struct inode *inode)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), 1, sector == ROOT_DIR_SECTOR ? NULL : inode);
+  size_t buckets = DIV_ROUND_UP (entry_cnt, DIR_BUCKET_ENTRIES);
+
+  ASSERT (BLOCK_SECTOR_SIZE % sizeof (struct dir_entry) == 0);
+  return inode_create (sector, buckets * BLOCK_SECTOR_SIZE, 1,
+                       sector == ROOT_DIR_SECTOR ? 0 : inode_get_inumber (inode));
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -86,58 +140,181 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches DIR for a file with the given NAME, using ENTRIES, a
+   caller-provided buffer of BLOCK_SECTOR_SIZE bytes, to hold one
+   bucket at a time.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, off_t *ofsp, struct dir_entry *entries) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  size_t buckets, b, probe, i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-	//printf("\n");
-	//printf("lookup: %s\n", name);
-  
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) {
-   	//hex_dump (0, &e, sizeof e, true);
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-	}
+  buckets = dir_buckets (dir);
+  b = hash_string (name) % buckets;
+  for (probe = 0; probe < buckets; probe++, b = (b + 1) % buckets)
+    {
+      bool open = false;
+
+      read_bucket (dir, b, entries);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &entries[i];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = b * BLOCK_SECTOR_SIZE + i * sizeof *e;
+              return true;
+            }
+          if (!e->in_use && e->name[0] == '\0')
+            open = true;
+        }
+
+      /* A never-used slot means NAME was never pushed past this
+         bucket. */
+      if (open)
+        break;
+    }
   return false;
+}
+
+/* Finds a free slot for NAME within MAX_PROBE buckets of its
+   home bucket and stores its byte offset in *OFSP.  ENTRIES is a
+   bucket-sized buffer as for lookup().  Returns false if there is
+   none. */
+static bool
+find_slot (const struct dir *dir, const char *name, size_t max_probe,
+           off_t *ofsp, struct dir_entry *entries)
+{
+  size_t buckets, b, probe, i;
 
+  buckets = dir_buckets (dir);
+  b = hash_string (name) % buckets;
+  for (probe = 0; probe < buckets && probe < max_probe;
+       probe++, b = (b + 1) % buckets)
+    {
+      read_bucket (dir, b, entries);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!entries[i].in_use)
+          {
+            *ofsp = b * BLOCK_SECTOR_SIZE + i * sizeof entries[i];
+            return true;
+          }
+    }
+  return false;
+}
+
+/* Puts E into the first free slot at or after its home bucket in
+   TABLE, an in-memory hash table of BUCKETS buckets that has room
+   for it. */
+static void
+place_entry (struct dir_entry *table, size_t buckets,
+             const struct dir_entry *e)
+{
+  size_t b = hash_string (e->name) % buckets;
+  size_t i;
 
+  for (;; b = (b + 1) % buckets)
+    for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+      if (!table[b * DIR_BUCKET_ENTRIES + i].in_use)
+        {
+          table[b * DIR_BUCKET_ENTRIES + i] = *e;
+          return;
+        }
+}
+
+/* Doubles the number of buckets in DIR and moves every entry to
+   its bucket in the larger table.  Returns false if memory or
+   disk space runs out, in which case DIR is left as it was.
+
+   The new table is built in memory first.  Every write that can
+   fail for lack of disk space happens before the old table is
+   overwritten: the old buckets are rewritten in place, which
+   backs any holes with sectors, and then the new upper half
+   extends the file.  Only after both succeed is the lower half
+   replaced, which just overwrites allocated sectors. */
+static bool
+grow (struct dir *dir)
+{
+  size_t buckets = dir_buckets (dir);
+  size_t cnt = buckets * DIR_BUCKET_ENTRIES, b, i;
+  off_t half = buckets * BLOCK_SECTOR_SIZE;
+  struct dir_entry *old, *new;
+  bool success = false;
+
+  old = malloc (cnt * sizeof *old);
+  new = calloc (2 * cnt, sizeof *new);
+  if (old == NULL || new == NULL)
+    goto done;
+  for (b = 0; b < buckets; b++)
+    read_bucket (dir, b, old + b * DIR_BUCKET_ENTRIES);
+  for (i = 0; i < cnt; i++)
+    if (old[i].in_use)
+      place_entry (new, 2 * buckets, &old[i]);
+
+  if (inode_write_at (dir->inode, old, half, 0) != half)
+    goto done;
+  if (inode_write_at (dir->inode, new + cnt, half, half) != half)
+    {
+      inode_truncate (dir->inode, half);
+      goto done;
+    }
+  success = inode_write_at (dir->inode, new, half, 0) == half;
+  ASSERT (success);
+
+ done:
+  free (old);
+  free (new);
+  return success;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Results, including misses, are remembered in the name cache,
+   unless DIR has been removed: its entries were purged then, and
+   its sector may be reused once it is closed. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  struct dir_entry e, *entries;
+  block_sector_t dir_sector, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  inode_lock (dir->inode);
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      entries = malloc (BLOCK_SECTOR_SIZE);
+      if (entries == NULL)
+        {
+          inode_unlock (dir->inode);
+          *inode = NULL;
+          return false;
+        }
+      sector = lookup (dir, name, &e, NULL, entries) ? e.inode_sector : DCACHE_NEGATIVE;
+      if (!inode_is_removed (dir->inode))
+        dcache_insert (dir_sector, name, sector);
+      free (entries);
+    }
+
+  if (sector != DCACHE_NEGATIVE)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 
@@ -148,14 +325,14 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR has been removed,
+   or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 
 
 {
-  struct dir_entry e;
+  struct dir_entry e, *entries;
   off_t ofs;
   bool success = false;
 
@@ -164,64 +341,97 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is
   /* Check NAME for validity. */
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  entries = malloc (BLOCK_SECTOR_SIZE);
+  if (entries == NULL)
+    return false;
+  inode_lock (dir->inode);
+  /* Check that DIR is still linked in and NAME is not in use. */
+  if (inode_is_removed (dir->inode)
+      || lookup (dir, name, NULL, NULL, entries))
     goto done;
-	/* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+
+  /* Set OFS to a free slot near NAME's home bucket.  If the
+     neighborhood is full, grow the table and take any slot. */
+  if (!find_slot (dir, name, DIR_MAX_PROBE, &ofs, entries)
+      && (!grow (dir)
+          || !find_slot (dir, name, dir_buckets (dir), &ofs, entries)))
+    goto done;
+  memset (&e, 0, sizeof e);
+
   /* Write slot. */
   e.in_use = true;
 	e.is_dir = is_dir;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
  done:
+  inode_unlock (dir->inode);
+  free (entries);
   return success;
 
 
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs
+   if there is no file with the given NAME or it is a directory
+   that is not empty.  A directory's own lock is held from the
+   emptiness check until it is marked removed, so nothing can be
+   added to it in between. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
+  struct dir_entry e, *entries;
   struct inode *inode = NULL;
-  bool success = false;
+  struct dir child;
+  bool is_dir, success = false;
   off_t ofs;
 
 	ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  entries = malloc (BLOCK_SECTOR_SIZE);
+  if (entries == NULL)
+    return false;
+  inode_lock (dir->inode);
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &e, &ofs, entries))
     goto done;
   /* Open inode. */
   inode = inode_open (e.inode_sector);
   if (inode == NULL)
     goto done;
+  is_dir = inode_is_dir (inode);
+  if (is_dir)
+    {
+      inode_lock (inode);
+      child.inode = inode;
+      child.pos = 0;
+      if (!is_empty (&child, entries))
+        goto unlock;
+    }
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
+    goto unlock;
+  if (!inode_is_removed (dir->inode))
+    dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+  if (is_dir)
+    dcache_purge (e.inode_sector);
+
   /* Remove inode. */
   inode_remove (inode);
-  inode_close (inode);
   success = true;
 
+ unlock:
+  if (is_dir)
+    inode_unlock (inode);
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
+  free (entries);
   return success;
 
 
@@ -234,17 +444,57 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  inode_lock (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock (dir->inode);
+  return found;
+}
+
+/* Marks the sectors of DIR and of everything below it as in use
+   in the free map. */
+void
+dir_reserve (struct dir *dir)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  inode_reserve (dir->inode);
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    {
+      struct inode *inode;
+
+      if (!e.in_use)
+        continue;
+      inode = inode_open (e.inode_sector);
+      if (inode == NULL)
+        continue;
+      if (inode_is_dir (inode))
+        {
+          struct dir *child = dir_open (inode);
+          if (child != NULL)
+            {
+              dir_reserve (child);
+              dir_close (child);
+            }
+        }
+      else
+        {
+          inode_reserve (inode);
+          inode_close (inode);
+        }
+    }
 }
 
 bool dir_is_relative (const char *);
@@ -265,6 +515,10 @@ dir_change_dir (const char *dir)
 
 	if (is_relative) {
 		directory = thread_current()->current_dir;
+		if (inode_is_removed(dir_get_inode(directory))) {
+			free(copy);
+			return false;
+		}
 	}
 	else {
 		directory = dir_open_root();
@@ -276,7 +530,8 @@ dir_change_dir (const char *dir)
 			if (!strcmp (token, "."))
 				continue;
 			else if (!strcmp (token, "..")) {
-				directory = dir_open((struct inode *)inode_get_parent(dir_get_inode(directory)));
+				block_sector_t parent = inode_get_parent(dir_get_inode(directory));
+				directory = parent != 0 ? dir_open(inode_open(parent)) : NULL;
 				if (directory == NULL) {
 					free(copy);
 					return false;
@@ -319,6 +574,10 @@ dir_make_dir (const char *dir)
 	is_relative = dir_is_relative(copy);
 	if (is_relative) {
 		directory = thread_current()->current_dir;
+		if (inode_is_removed(dir_get_inode(directory))) {
+			free(copy);
+			return false;
+		}
 	}
 	else {
 		directory = dir_open_root();
@@ -339,7 +598,14 @@ dir_make_dir (const char *dir)
 	
 					if (free_map_allocate(1, &sector)) {
 						bool success;
-						success = dir_create (sector, 16, directory->inode)	&& dir_add (directory, token, sector, true);
+						if (!dir_create (sector, 16, directory->inode)) {
+							free_map_release (sector, 1);
+							free(copy);
+							return false;
+						}
+						success = dir_add (directory, token, sector, true);
+						if (!success)
+							inode_discard (sector);
 						free(copy);
 						return success;
 					}
@@ -26,6 +26,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t, bool);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+void dir_reserve (struct dir *);
 
 bool dir_change_dir (const char *);
 bool dir_make_dir (const char *);
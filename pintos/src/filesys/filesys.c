@@ -6,15 +6,16 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
-struct lock fs_lock;
 
 static void do_format (void);
+static void rebuild_free_map (void);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -27,12 +28,14 @@ filesys_init (bool format)
 	
 	cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
-	lock_init(&fs_lock);
 
   if (format) 
     do_format ();
-  free_map_open ();
+  if (!free_map_open ())
+    rebuild_free_map ();
+	cache_daemon_init ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -40,8 +43,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-	cache_close ();
+  cache_daemon_stop ();
   free_map_close ();
+	cache_close ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -51,17 +55,15 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-	lock_acquire(&fs_lock);
 	struct dir *dir;
 	struct inode *inode;
 	block_sector_t inode_sector = 0;
-	bool is_relative, success = false, tmp1, tmp2, tmp3;
+	bool is_relative, success = false;
 	char *token, *save_ptr, *copy;
 
 	//printf("filesys_create: create file %s (size %d)\n", name, initial_size);
 
 	if (strlen(name) == 0) {
-		lock_release(&fs_lock);
 		return false;
 	}
 	copy = malloc(sizeof(char) * (strlen(name) + 1));
@@ -83,7 +85,6 @@ filesys_create (const char *name, off_t initial_size)
 	for (token = strtok_r (copy, "/", &save_ptr); token != NULL; token = strtok_r(NULL, "/", &save_ptr)) {
 
 		if (inode_is_removed(dir_get_inode(dir))) {
-			lock_release(&fs_lock);
 			free(copy);
 			return NULL;
 		}
@@ -96,14 +97,15 @@ filesys_create (const char *name, off_t initial_size)
 					break;
 				}
 				else {
-          tmp1 = free_map_allocate (1, &inode_sector);
-          tmp2 = inode_create (inode_sector, initial_size, 0, NULL);
-          tmp3 = dir_add (dir, token, inode_sector, false);
-					//printf("temp1 %d, temp2 %d, temp3 %d\n", tmp1, tmp2, tmp3);
-					success = (dir != NULL
-										&& tmp1
-										&& tmp2
-										&& tmp3);
+					if (dir == NULL || !free_map_allocate (1, &inode_sector))
+						break;
+					if (!inode_create (inode_sector, initial_size, 0, 0)) {
+						free_map_release (inode_sector, 1);
+						break;
+					}
+					success = dir_add (dir, token, inode_sector, false);
+					if (!success)
+						inode_discard (inode_sector);
 //					if (success)
 //						printf("filesys_create: create file %s at sector 0x%x\n", name, inode_sector);
 					break;
@@ -119,7 +121,6 @@ filesys_create (const char *name, off_t initial_size)
 		}
 	}
 
-	lock_release(&fs_lock);
 	free(copy);
 	return success;
 }
@@ -132,14 +133,12 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-	lock_acquire(&fs_lock);
 	struct dir *dir, *prev_dir;
 	struct inode *inode;
 	bool is_relative;
 	char *token, *save_ptr, *copy;
 	
 	if (strlen(name) == 0) {
-		lock_release(&fs_lock);
 		return NULL;
 	}
 
@@ -163,7 +162,6 @@ filesys_open (const char *name)
 
 	for (token = strtok_r (copy, "/", &save_ptr); token != NULL; token = strtok_r(NULL, "/", &save_ptr)) {
 		if (inode_is_removed(dir_get_inode(dir))) {
-			lock_release(&fs_lock);
 			free(copy);
 
 			return NULL;
@@ -179,7 +177,6 @@ filesys_open (const char *name)
 				}
 			}
 			else {
-				lock_release(&fs_lock);
 				free(copy);
 				return NULL;
 			}
@@ -187,7 +184,6 @@ filesys_open (const char *name)
 		
 		if (!inode_is_dir(inode)) {
 			if (save_ptr[0] != '\0'){
-				lock_release(&fs_lock);
 				free(copy);
 				return NULL;
 			}
@@ -199,7 +195,6 @@ filesys_open (const char *name)
 			dir = dir_open(inode);
 		}
 	}
-	lock_release(&fs_lock);
 	free(copy);
   return file_open (inode);
 }
@@ -211,7 +206,6 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-	lock_acquire(&fs_lock);
 //	struct dir *dir = dir_open_root ();
 //	bool success = dir != NULL && dir_remove (dir, name);
 	struct dir *dir;
@@ -220,7 +214,6 @@ filesys_remove (const char *name)
 	char *token, *save_ptr, *copy;
 
 	if (strlen(name) == 0) {
-		lock_release(&fs_lock);
 		return false;
 	}
 
@@ -253,6 +246,7 @@ filesys_remove (const char *name)
 			}
 			else {
 				success = dir != NULL && dir_remove (dir, token);
+				inode_close (inode);
 				break;
 			}
 		}
@@ -260,15 +254,13 @@ filesys_remove (const char *name)
 			if (save_ptr[0] != '\0')
 				dir = dir_open(inode);
 			else {
-				char temp[NAME_MAX + 1];
-				if (dir != NULL && !dir_readdir(dir_open (inode), temp)){
-					success = dir_remove (dir, token);
-				}
+				/* dir_remove() checks that the directory is empty. */
+				success = dir != NULL && dir_remove (dir, token);
+				inode_close (inode);
 				break;
 			}
 		}
 	}
-	lock_release(&fs_lock);
 	free(copy);
   return success;
 }
@@ -276,24 +268,34 @@ filesys_remove (const char *name)
 bool
 filesys_chdir (const char *name)
 {
-	bool success;
-	lock_acquire(&fs_lock);
-	success = dir_change_dir (name);
-	lock_release(&fs_lock);
-	return success;
+	return dir_change_dir (name);
 }
 
 bool
 filesys_mkdir (const char *name)
 {
-	bool success;
-	lock_acquire(&fs_lock);
-	success = dir_make_dir (name);
-	lock_release(&fs_lock);
-	return success;
+	return dir_make_dir (name);
 }
 
 
+/* Rebuilds the free map from the inodes reachable from the root
+   directory, after the file system was not shut down cleanly. */
+static void
+rebuild_free_map (void)
+{
+  struct dir *root;
+
+  printf ("Rebuilding free map...");
+  root = dir_open_root ();
+  if (root == NULL)
+    PANIC ("can't open root directory");
+  free_map_reset ();
+  dir_reserve (root);
+  dir_close (root);
+  free_map_flush ();
+  printf ("done.\n");
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
@@ -1,70 +1,247 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Guards FREE_MAP and FREE_MAP_DIRTY.  Callers may hold an inode
+   lock when they allocate, so this lock comes after any inode
+   lock except the free map file's own, which free_map_flush()
+   takes while holding it.  The free map file is fully allocated
+   when it is created, so writing it never allocates. */
+static struct lock free_map_lock;
+
+/* Changes to the free map stay in memory until free_map_flush().
+   One bit per sector of the free map file records which parts
+   have changed since they were last written. */
+#define FREE_MAP_CHUNK (BLOCK_SECTOR_SIZE * 8)
+static struct bitmap *free_map_dirty;
+
+/* The byte after the bitmap in the free map file says whether
+   the file system was shut down cleanly.  It is cleared while
+   the file system is mounted; if it is still clear at the next
+   mount, the bitmap on disk may be stale and must be rebuilt. */
+#define FREE_MAP_CLEAN 0xc1
+#define FREE_MAP_MOUNTED 0
+
+static void mark_dirty (block_sector_t, size_t);
+static void write_state (uint8_t);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                                FREE_MAP_CHUNK));
+  if (free_map == NULL || free_map_dirty == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+}
+
+/* Records that the bits for CNT sectors starting at SECTOR have
+   changed. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / FREE_MAP_CHUNK;
+  size_t last = (sector + cnt - 1) / FREE_MAP_CHUNK;
+
+  if (cnt > 0)
+    bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+  if (sector == BITMAP_ERROR)
+    return false;
+  *sectorp = sector;
+  return true;
+}
+
+/* Allocates the free sectors that directly follow SECTOR - 1,
+   up to CNT of them, so that a run ending there can be
+   lengthened in place.  Returns the number allocated, which is 0
+   if SECTOR itself is in use. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  while (n < cnt && sector + n < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + n))
+    n++;
+  bitmap_set_multiple (free_map, sector, n, true);
+  mark_dirty (sector, n);
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Allocates the CNT sectors starting at SECTOR if all of them are
+   free.  Returns true if successful, false if any is in use. */
+bool
+free_map_claim (block_sector_t sector, size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = (sector + cnt <= bitmap_size (free_map)
+             && bitmap_none (free_map, sector, cnt));
+  if (success)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.  Their
+   cached copies are dropped without being written back, before
+   anyone can allocate them again. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    cache_delete (sector + i);
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Marks CNT sectors starting at SECTOR as in use, whatever their
+   current state.  Used while rebuilding the free map. */
+void
+free_map_mark (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Forgets every allocation except the free map file and the root
+   directory inode, before the free map is rebuilt from the
+   inodes that are reachable from the root. */
+void
+free_map_reset (void)
+{
+  lock_acquire (&free_map_lock);
+  bitmap_set_all (free_map, false);
+  bitmap_mark (free_map, FREE_MAP_SECTOR);
+  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_all (free_map_dirty, true);
+  lock_release (&free_map_lock);
+  inode_reserve (file_get_inode (free_map_file));
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Writes the parts of the free map that changed since the last
+   flush to the free map file. */
 void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file == NULL)
+    {
+      lock_release (&free_map_lock);
+      return;
+    }
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    if (bitmap_test (free_map_dirty, i))
+      {
+        size_t start = i * FREE_MAP_CHUNK;
+        size_t cnt = bitmap_size (free_map) - start;
+
+        /* Clear first, so changes made while writing are caught
+           by the next flush. */
+        bitmap_reset (free_map_dirty, i);
+        if (cnt > FREE_MAP_CHUNK)
+          cnt = FREE_MAP_CHUNK;
+        if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+          bitmap_mark (free_map_dirty, i);
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Writes STATE into the clean-shutdown byte of the free map
+   file. */
+static void
+write_state (uint8_t state)
+{
+  if (file_write_at (free_map_file, &state, 1, bitmap_file_size (free_map)) != 1)
+    PANIC ("can't write free map");
+}
+
+/* Opens the free map file and reads it from disk, then marks the
+   file system as mounted.  Returns false if the file system was
+   not shut down cleanly, in which case the map just read may be
+   stale and the caller should rebuild it. */
+bool
 free_map_open (void) 
 {
+  uint8_t state;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, free_map_file)
+      || file_read_at (free_map_file, &state, 1, bitmap_file_size (free_map)) != 1)
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+
+  /* The mounted mark must be on disk before anything else is. */
+  write_state (FREE_MAP_MOUNTED);
+  cache_flush ();
+  return state == FREE_MAP_CLEAN;
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file.
+   Everything else in the cache reaches the disk first, and the
+   clean-shutdown mark last, so a crash part way through leaves
+   the file system marked as mounted. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  cache_flush ();
+  write_state (FREE_MAP_CLEAN);
+  cache_flush ();
+
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,8 +249,8 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
-  /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0, NULL))
+  /* Create inode, with room for the clean-shutdown byte. */
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map) + 1, 0, 0))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -82,4 +259,6 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  write_state (FREE_MAP_MOUNTED);
+  bitmap_set_all (free_map_dirty, false);
 }
@@ -8,10 +8,16 @@
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
-void free_map_open (void);
+bool free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_extend (block_sector_t, size_t);
+bool free_map_claim (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_flush (void);
+
+void free_map_mark (block_sector_t, size_t);
+void free_map_reset (void);
 
 #endif /* filesys/free-map.h */
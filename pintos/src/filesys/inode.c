@@ -1,43 +1,64 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sectors past a sequential read to prefetch. */
+#define READ_AHEAD_SECTORS 4
+
+/* Free sectors kept reserved past the end of a growing file, so
+   that appends can keep lengthening its last extent even while
+   other files are allocating. */
+#define INODE_GROW_MIN 8
+
+/* Extents stored in the inode itself, and in its overflow
+   extent block. */
+#define INODE_EXTENTS 60
+#define BLOCK_EXTENTS 64
+#define INODE_MAX_EXTENTS (INODE_EXTENTS + BLOCK_EXTENTS)
+
+/* START of an extent that is a hole.  Sector 0 holds the free
+   map inode, so it is never file data. */
+#define HOLE_SECTOR 0
+
+/* A run of LENGTH physically contiguous sectors starting at
+   START, holding the next LENGTH sectors of the file.  A hole
+   has no sectors allocated and reads as zeros. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-		//struct lock sector_lock;
-    //struct list *sector_list;           /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
 		uint32_t is_dir;										/* 0: ordinary file, 1: directory */
-		uint32_t direct;
-    uint32_t indirect;
-    uint32_t double_indirect;
-    void *parent;												/* INODE of parent directory */
-    uint32_t unused[100];               /* Not used. */
-    block_sector_t sectors[21]; // 16 direct 4 indirect 1 double
+    block_sector_t parent;              /* Parent directory's inode, 0 if none. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    block_sector_t extent_block;        /* Overflow extents, 0 if none. */
+    uint32_t unused[2];                 /* Not used. */
+    struct extent extents[INODE_EXTENTS];
   };
 
-struct inode_disk_elem
-{
-	struct list_elem list_elem;
-	block_sector_t sector;
-};
-
-struct indirect_inode
-{
-  block_sector_t sectors[128];
-};
+/* Sector holding extents past the first INODE_EXTENTS. */
+struct extent_block
+  {
+    struct extent extents[BLOCK_EXTENTS];
+  };
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -47,107 +68,417 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-static inline size_t
-bytes_to_indirect (off_t size)
-{
-  if (size <= 16 * BLOCK_SECTOR_SIZE){
-    return 0;
-  }
-  else {
-    return DIV_ROUND_UP (size - 16 * BLOCK_SECTOR_SIZE, 128 * BLOCK_SECTOR_SIZE);
-  }
-}
-
-static inline size_t
-bytes_to_double_indirect (off_t size)
-{
-  if (size <= BLOCK_SECTOR_SIZE * 16 + BLOCK_SECTOR_SIZE * 128 * 4){
-    return 0;
-  }
-  else {
-    return 1;
-  }
-}
-
-/* In-memory inode. */
-struct inode 
+/* In-memory inode.  It must fit in a single malloc() block, so
+   only the extents the on-disk inode holds are kept inline; an
+   inode with an overflow extent block gets a separate array for
+   the full map.
+   OPEN_CNT, LOADING and LOAD_FAILED are guarded by
+   open_inodes_lock.  RWLOCK is held for reading while data is
+   read and for writing while the inode is written, so that
+   LENGTH, DENY_WRITE_CNT and the extent map only change under an
+   exclusive hold. */
+struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     off_t length;                       /* File size in bytes. */
     uint32_t is_dir;                    /* 0: ordinary file, 1: directory */
-    uint32_t direct;
-    uint32_t indirect;
-    uint32_t double_indirect;
-    void *parent;
-    block_sector_t sectors[21];
-    //struct inode_disk data;             /* Inode content. */
+    block_sector_t parent;              /* Parent directory's inode, 0 if none. */
+    struct rwlock rwlock;               /* Readers or one writer. */
+    struct lock dir_lock;               /* Serializes directory operations. */
+    off_t read_end;                     /* End of the last read, for read-ahead. */
+    off_t read_ahead;                   /* Prefetch already requested up to here. */
+    bool loading;                       /* Being read in by inode_open()? */
+    bool load_failed;                   /* Reading it in failed? */
+    struct condition loaded;            /* Signaled when LOADING ends. */
+
+    /* Extent map, loaded whole at open time.  EXTENTS points to
+       INLINE_EXTENTS until the map outgrows the inode sector. */
+    block_sector_t extent_block;        /* Overflow extents, 0 if none. */
+    size_t extent_cnt;                  /* Number of extents in use. */
+    size_t sector_cnt;                  /* Sectors covered by all extents. */
+    size_t hint_ext;                    /* Extent of the last lookup... */
+    size_t hint_first;                  /* ...and its first file sector. */
+    block_sector_t prealloc_start;      /* Sectors reserved after the last */
+    size_t prealloc_cnt;                /* ...extent, not yet in the map. */
+    struct extent *extents;
+    struct extent inline_extents[INODE_EXTENTS];
   };
 
-block_sector_t inode_extend(struct inode *, int);
-bool get_inode_block (struct inode_disk *, char *, int);
+static bool inode_grow (struct inode *, size_t);
+static block_sector_t inode_allocate (struct inode *, size_t, size_t, size_t *);
+void inode_update (struct inode *);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns HOLE_SECTOR if POS falls in a hole, or -1 if INODE
+   does not contain data for a byte at offset POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos)
 {
+  size_t idx, i, first;
+  enum intr_level old_level;
+
   ASSERT (inode != NULL);
-	//printf("inode at sector %d - length %d\n", inode->sector, inode->length);
-  if (pos < inode->length){
-    int tmp;
-    uint32_t indirect[128];
-    uint32_t double_indirect[128];
-    if (pos < BLOCK_SECTOR_SIZE * 16){
-      return inode->sectors[pos/BLOCK_SECTOR_SIZE];
+  if (pos >= inode->length)
+    return -1;
+
+  /* Sequential access usually stays in or just past the extent
+     found last time, so start searching there.  Concurrent
+     readers share the hint, so its two halves are read and
+     written with interrupts off. */
+  idx = pos / BLOCK_SECTOR_SIZE;
+  old_level = intr_disable ();
+  i = inode->hint_ext;
+  first = inode->hint_first;
+  intr_set_level (old_level);
+  if (idx < first)
+    i = first = 0;
+  for (; i < inode->extent_cnt; first += inode->extents[i++].length)
+    if (idx < first + inode->extents[i].length)
+      {
+        old_level = intr_disable ();
+        inode->hint_ext = i;
+        inode->hint_first = first;
+        intr_set_level (old_level);
+        if (inode->extents[i].start == HOLE_SECTOR)
+          return HOLE_SECTOR;
+        return inode->extents[i].start + (idx - first);
+      }
+  return -1;
+}
+
+/* Fills CNT sectors starting at SECTOR with zeros.  Only the
+   cache is touched; the zeros reach the disk with the next flush,
+   unless they are overwritten first. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  while (cnt-- > 0)
+    cache_write_at (sector++, zeros, 0, BLOCK_SECTOR_SIZE, CACHE_DATA);
+}
+
+/* Moves INODE's extent map into a separately allocated array
+   with room for INODE_MAX_EXTENTS extents, if it is not already
+   in one. */
+static bool
+widen_extents (struct inode *inode)
+{
+  struct extent *extents;
+
+  if (inode->extents != inode->inline_extents)
+    return true;
+  extents = malloc (INODE_MAX_EXTENTS * sizeof *extents);
+  if (extents == NULL)
+    return false;
+  memcpy (extents, inode->inline_extents, sizeof inode->inline_extents);
+  inode->extents = extents;
+  return true;
+}
+
+/* Frees INODE's extent map if it was moved out of the inode. */
+static void
+free_extents (struct inode *inode)
+{
+  if (inode->extents != inode->inline_extents)
+    free (inode->extents);
+}
+
+/* Makes sure INODE can hold EXTRA more extents, allocating its
+   overflow extent block if that becomes necessary. */
+static bool
+reserve_extents (struct inode *inode, size_t extra)
+{
+  if (inode->extent_cnt + extra > INODE_MAX_EXTENTS)
+    return false;
+  if (inode->extent_cnt + extra > INODE_EXTENTS && inode->extent_block == 0)
+    {
+      if (!widen_extents (inode))
+        return false;
+      return free_map_allocate (1, &inode->extent_block);
+    }
+  return true;
+}
+
+/* Gives back the sectors INODE has reserved for appends. */
+static void
+release_prealloc (struct inode *inode)
+{
+  if (inode->prealloc_cnt > 0)
+    free_map_release (inode->prealloc_start, inode->prealloc_cnt);
+  inode->prealloc_cnt = 0;
+}
+
+/* Tops up the sectors INODE keeps reserved right after its last
+   extent, if that extent is allocated.  The free map file never
+   grows, and stays open while the free map is rebuilt, so it
+   reserves nothing. */
+static void
+reserve_prealloc (struct inode *inode)
+{
+  struct extent *last;
+  block_sector_t end;
+
+  if (inode->extent_cnt == 0 || inode->sector == FREE_MAP_SECTOR)
+    return;
+  last = &inode->extents[inode->extent_cnt - 1];
+  if (last->start == HOLE_SECTOR)
+    return;
+  end = last->start + last->length;
+  if (inode->prealloc_cnt > 0 && inode->prealloc_start != end)
+    release_prealloc (inode);
+  inode->prealloc_start = end;
+  if (inode->prealloc_cnt < INODE_GROW_MIN)
+    inode->prealloc_cnt += free_map_extend (end + inode->prealloc_cnt,
+                                            INODE_GROW_MIN
+                                            - inode->prealloc_cnt);
+}
+
+/* Allocates up to CNT sectors starting at START, the end of one
+   of INODE's extents, taking them from the sectors reserved there
+   first.  If ALL, allocates either all CNT or none.  Returns the
+   number allocated. */
+static size_t
+extend_run (struct inode *inode, block_sector_t start, size_t cnt, bool all)
+{
+  size_t got = 0;
+
+  if (inode->prealloc_cnt > 0 && inode->prealloc_start == start)
+    {
+      got = cnt < inode->prealloc_cnt ? cnt : inode->prealloc_cnt;
+      if (got < cnt)
+        {
+          size_t rest = cnt - got;
+
+          if (all)
+            {
+              if (!free_map_claim (start + got, rest))
+                return 0;
+            }
+          else
+            rest = free_map_extend (start + got, rest);
+          got += rest;
+          inode->prealloc_cnt = 0;
+        }
+      else
+        {
+          inode->prealloc_start += got;
+          inode->prealloc_cnt -= got;
+        }
+      return got;
     }
-    else if (pos < BLOCK_SECTOR_SIZE * 16 + BLOCK_SECTOR_SIZE * 128 * 4){
-      tmp = ((pos - 16 * BLOCK_SECTOR_SIZE) / (BLOCK_SECTOR_SIZE * 128)) + 16;
-      //printf("byte to sector indirect : %d, %d\n", tmp, ((pos - 16 * BLOCK_SECTOR_SIZE) % (BLOCK_SECTOR_SIZE * 128)) / BLOCK_SECTOR_SIZE);
-      block_read (fs_device, inode->sectors[tmp], indirect);
-      //hex_dump (0, indirect, 128, true);
-      //printf("sector number? : %d\n", indirect[((pos - 16 * BLOCK_SECTOR_SIZE) % (BLOCK_SECTOR_SIZE * 128)) / BLOCK_SECTOR_SIZE]);
-      return indirect[((pos - 16 * BLOCK_SECTOR_SIZE) % (BLOCK_SECTOR_SIZE * 128)) / BLOCK_SECTOR_SIZE];
+  if (all)
+    return free_map_claim (start, cnt) ? cnt : 0;
+  return free_map_extend (start, cnt);
+}
+
+/* Extends INODE with a hole so that its extents cover SECTORS
+   sectors.  If the extent table is full, lengthens the last
+   extent with zeroed sectors instead.  Returns false if neither
+   is possible. */
+static bool
+inode_grow (struct inode *inode, size_t sectors)
+{
+  struct extent *last;
+
+  if (inode->sector_cnt >= sectors)
+    return true;
+
+  last = inode->extent_cnt > 0 ? &inode->extents[inode->extent_cnt - 1] : NULL;
+  if (last == NULL || last->start != HOLE_SECTOR)
+    {
+      if (!reserve_extents (inode, 1))
+        {
+          size_t cnt = sectors - inode->sector_cnt;
+          block_sector_t end;
+
+          if (last == NULL)
+            return false;
+          end = last->start + last->length;
+          if (extend_run (inode, end, cnt, true) == 0)
+            return false;
+          zero_sectors (end, cnt);
+          last->length += cnt;
+          inode->sector_cnt = sectors;
+          return true;
+        }
+      last = &inode->extents[inode->extent_cnt++];
+      last->start = HOLE_SECTOR;
+      last->length = 0;
     }
-    else {
-      block_read (fs_device, inode->sectors[20], double_indirect);
-      tmp = (pos - (BLOCK_SECTOR_SIZE * 16) - (BLOCK_SECTOR_SIZE * 128 * 4)) / (BLOCK_SECTOR_SIZE * 128);
-      block_read (fs_device, double_indirect[tmp], indirect);
-      tmp = (pos - (BLOCK_SECTOR_SIZE * 16) - (BLOCK_SECTOR_SIZE * 128 * 4)) % (BLOCK_SECTOR_SIZE * 128);
-      return indirect[tmp / BLOCK_SECTOR_SIZE];
+  last->length += sectors - inode->sector_cnt;
+  inode->sector_cnt = sectors;
+  return true;
+}
+
+/* Allocates sectors for the hole in INODE that contains file
+   sector IDX, for up to CNT sectors starting there, and returns
+   the first one.  Stores the number allocated in *ALLOCATED.
+   The extent just before the hole is lengthened in place when
+   the sectors after it are free, and the extent just after it is
+   lengthened backward when the run would end at that extent;
+   otherwise the hole is split around a new run, as long as the
+   free map can provide, halving the request until it fits.  If
+   the extent table has no room for the split, the whole hole is
+   backed with one run, zeroed outside the request.  Returns
+   HOLE_SECTOR if the disk or the extent table is full. */
+static block_sector_t
+inode_allocate (struct inode *inode, size_t idx, size_t cnt, size_t *allocated)
+{
+  size_t i, first, before, after, extra, got;
+  block_sector_t start;
+  struct extent *hole;
+
+  for (i = first = 0; i < inode->extent_cnt; first += inode->extents[i++].length)
+    if (idx < first + inode->extents[i].length)
+      break;
+  ASSERT (i < inode->extent_cnt);
+  hole = &inode->extents[i];
+  ASSERT (hole->start == HOLE_SECTOR);
+
+  before = idx - first;
+  if (cnt > hole->length - before)
+    cnt = hole->length - before;
+
+  /* Lengthen the previous extent into the start of the hole. */
+  if (before == 0 && i > 0)
+    {
+      struct extent *prev = &inode->extents[i - 1];
+
+      start = prev->start + prev->length;
+      got = extend_run (inode, start, cnt, false);
+      if (got > 0)
+        {
+          prev->length += got;
+          hole->length -= got;
+          if (hole->length == 0)
+            {
+              memmove (hole, hole + 1,
+                       (inode->extent_cnt - i - 1) * sizeof *hole);
+              inode->extent_cnt--;
+            }
+          inode->hint_ext = inode->hint_first = 0;
+          reserve_prealloc (inode);
+          *allocated = got;
+          return start;
+        }
     }
-  }
-  else
-    return -1;
-//	printf("byte_to_sector pos %d, length %d\n", pos, inode->data.length);
-  /*if (pos < inode->data.length) {
-		int i;
-		struct list_elem *e = list_front(inode->data.sector_list);
-		for (i = 0; i < pos / BLOCK_SECTOR_SIZE; i++) {
-			e = list_next(e);
-			if (e == list_end(inode->data.sector_list))
-				return -1;
-		}
-
-    return list_entry(e, struct inode_disk_elem, list_elem)->sector;
-	}
-  else
-    return -1;*/
+
+  /* Lengthen the next extent backward over the end of the hole. */
+  if (before + cnt == hole->length && i + 1 < inode->extent_cnt)
+    {
+      struct extent *next = &inode->extents[i + 1];
+
+      if (next->start >= cnt && free_map_claim (next->start - cnt, cnt))
+        {
+          next->start -= cnt;
+          next->length += cnt;
+          hole->length -= cnt;
+          if (hole->length == 0)
+            {
+              memmove (hole, hole + 1,
+                       (inode->extent_cnt - i - 1) * sizeof *hole);
+              inode->extent_cnt--;
+            }
+          inode->hint_ext = inode->hint_first = 0;
+          *allocated = cnt;
+          return next->start;
+        }
+    }
+
+  /* Split the hole into [hole before] [new run] [hole after]. */
+  for (got = cnt; got > 0; got /= 2)
+    if (free_map_allocate (got, &start))
+      break;
+  if (got == 0)
+    return HOLE_SECTOR;
+  after = hole->length - before - got;
+  extra = (before > 0) + (after > 0);
+  if (!reserve_extents (inode, extra))
+    {
+      free_map_release (start, got);
+      if (!free_map_allocate (hole->length, &start))
+        return HOLE_SECTOR;
+      zero_sectors (start, before);
+      zero_sectors (start + before + cnt, hole->length - before - cnt);
+      hole->start = start;
+      inode->hint_ext = inode->hint_first = 0;
+      reserve_prealloc (inode);
+      *allocated = cnt;
+      return start + before;
+    }
+  memmove (hole + extra, hole, (inode->extent_cnt - i) * sizeof *hole);
+  inode->extent_cnt += extra;
+  if (before > 0)
+    {
+      hole->start = HOLE_SECTOR;
+      hole->length = before;
+      hole++;
+    }
+  hole->start = start;
+  hole->length = got;
+  if (after > 0)
+    {
+      hole[1].start = HOLE_SECTOR;
+      hole[1].length = after;
+    }
+  inode->hint_ext = inode->hint_first = 0;
+  reserve_prealloc (inode);
+  *allocated = got;
+  return start;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Returns how the buffer cache should treat INODE's data
+   sectors.  Directory contents and the free map are looked at on
+   every path resolution and allocation, so they are kept like
+   metadata. */
+static enum cache_type
+inode_cache_type (const struct inode *inode)
+{
+  if (inode->sector == FREE_MAP_SECTOR)
+    return CACHE_FREE_MAP;
+  if (inode->is_dir)
+    return CACHE_META;
+  return CACHE_DATA;
+}
+
+/* Open inodes by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static unsigned inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
 
 /* Initializes the inode module. */
 void
-inode_init (void) 
+inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode_init: hash init failed");
+  lock_init (&open_inodes_lock);
+}
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -156,226 +487,148 @@ inode_init (void)
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length, uint32_t is_dir, void *parent)
+inode_create (block_sector_t sector, off_t length, uint32_t is_dir,
+              block_sector_t parent)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = true;
-  //printf("come to inode_create, %d\n", length);
+  struct inode *inode;
+  bool success;
+
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
-  
-	disk_inode = calloc (1, sizeof *disk_inode);
-  char *zeros;//[BLOCK_SECTOR_SIZE];
-  zeros = calloc (1, BLOCK_SECTOR_SIZE);
-  if (disk_inode != NULL)
+  ASSERT (sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  inode = calloc (1, sizeof *inode);
+  if (inode == NULL)
+    return false;
+  inode->sector = sector;
+  inode->is_dir = is_dir;
+  inode->parent = parent;
+  inode->extents = inode->inline_extents;
+  inode->prealloc_cnt = 0;
+
+  /* The data starts out as one hole, so no sectors are
+     allocated or zeroed until they are written. */
+  success = inode_grow (inode, bytes_to_sectors (length));
+  if (success)
     {
-			size_t sectors = bytes_to_sectors (length), i;
-      block_sector_t tmp;
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-			disk_inode->is_dir = is_dir;
-			disk_inode->parent = parent;
-			
-			// direct
-      if (sectors <= 16){
-        for (i = 0; i < sectors; i++) {
-          success = get_inode_block (disk_inode, zeros, i);
-          if (!success) {
-            break;
-          }
-        }
-        disk_inode->direct = sectors-1;
-      }
-      // indirect
-      else {
-        for (i = 0; i < 16; i++) {
-          success = get_inode_block (disk_inode, zeros, i);
-          if (!success) {
-            break;
-          }
-        }
-        //printf("now go to indirect\n");
-        disk_inode->direct = 15;
-        sectors -= 16;
-        int indirect_idx = 15;
-        int indirect_sector = 0;
-        struct indirect_inode *indirect;
-        // while sectors > 0 and can be covered with indirect.
-        if (sectors > 0){
-          indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-        }
-        while (sectors > 0) {
-          if (indirect_sector % 128 == 0) {
-            if (indirect != NULL && indirect_idx != 15){
-              //printf("come to here : %d\n", indirect_sector);
-              block_write (fs_device, disk_inode->sectors[indirect_idx], indirect);
-              free (indirect);
-            }
-            // indirect full break and goto double
-            if (indirect_idx == 19) {
-              break;
-            }
-            indirect_idx++;
-            indirect_sector = 0;
-            success = get_inode_block (disk_inode, zeros, indirect_idx);
-            if (!success) {
-              break;
-            }
-            indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-          }
-          //printf(" indirect interior : %d\n", indirect_sector);
-          if (free_map_allocate (1, &tmp)) { 
-            success = true;
-            block_write (fs_device, tmp, zeros);
-            indirect->sectors[indirect_sector] = tmp;
-          }
-          else {
-            //printf("free_map_allocate fail\n");
-            success = false;
-            break;
-          }
-          sectors--;
-          indirect_sector++;
-        }
-        disk_inode->indirect = indirect_idx;
-        // ended with indirect, need to write last indirect inode.
-        if (bytes_to_double_indirect (length) == 0) {
-          block_write (fs_device, disk_inode->sectors[indirect_idx], indirect);
-          free (indirect);
-        }
-        // double indirect
-        else {
-          struct indirect_inode *double_indirect;
-          disk_inode->double_indirect = 20;
-          success = get_inode_block (disk_inode, zeros, 20);
-          if (!success) {
-            block_write (fs_device, sector, disk_inode);
-            free (disk_inode);
-            free (zeros);
-            return success;
-          }
-          double_indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-          indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-          indirect_idx = -1;
-          indirect_sector = 0;
-          while (sectors > 0) {
-            // indirect block full, need to make new
-            if (indirect_sector % 128 == 0) {
-              if (indirect != NULL){
-                block_write (fs_device, double_indirect->sectors[indirect_idx], indirect);
-                free (indirect);
-              }
-              indirect_idx++;
-              indirect_sector = 0;
-              // make new indirect block and save sector number in double_indirect block.
-              if (free_map_allocate (1, &tmp)) {
-                success = true;
-                block_write (fs_device, tmp, zeros);
-                double_indirect->sectors[indirect_idx] = tmp;
-              }
-              else {
-                success = false;
-                break;
-              }
-              indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-            }
-            if (free_map_allocate (1, &tmp)) { 
-              success = true;
-              block_write (fs_device, tmp, zeros);
-              indirect->sectors[indirect_sector] = tmp;
-            }
-            else {
-              success = false;
-              break;
-            }
-            sectors--;
-            indirect_sector++;
-          }
-          // finish store the last indirect block content and double indirect block content to disk.
-          block_write (fs_device, double_indirect->sectors[indirect_idx], indirect);
-          if (indirect != NULL){
-            free (indirect);
-          }
-          block_write (fs_device, disk_inode->sectors[20], double_indirect);
-          free (double_indirect);
-        }
-      }
-      block_write (fs_device, sector, disk_inode);
-      free (disk_inode);
+      inode->length = length;
+      inode_update (inode);
     }
-  //printf("inode create finish\n");
-  free (zeros);
+  else
+    inode_clear (inode);
+  release_prealloc (inode);
+  free_extents (inode);
+  free (inode);
   return success;
 }
 
-			/*for (i = 0; i < sectors; i++) {
-				struct inode_disk_elem *e = malloc(sizeof(struct inode_disk_elem));
-				ASSERT (e != NULL);
-
-				if (free_map_allocate (1, &e->sector)) {
-					success = true;
-					block_write (fs_device, e->sector, zeros);
-					//list_push_back (disk_inode->sector_list, &e->list_elem);
-				}
-				else {
-					success = false;
-					break;
-				}
-			}
-			
-			if (sectors == 0)
-				success = true;
-
-			block_write (fs_device, sector, disk_inode);
-			free (disk_inode);
-  return success;
-}*/
-
-
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+   The inode is entered in open_inodes before it is read, marked
+   as loading, so that the disk reads happen without
+   open_inodes_lock; anyone else opening it meanwhile waits for
+   the load to finish. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  static struct inode key;       /* Too big for the stack; guarded
+                                   by open_inodes_lock. */
+  struct hash_elem *e;
   struct inode *inode;
-  //printf("come to inode_open, sector what? : %d\n", sector);
+  struct inode_disk *data;
+  bool success;
+  size_t i;
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      if (inode->load_failed)
         {
-          inode_reopen (inode);
-          return inode; 
+          if (--inode->open_cnt == 0)
+            free (inode);
+          inode = NULL;
         }
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
-  //printf("come to here\n");
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
+
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  inode->load_failed = false;
+  cond_init (&inode->loaded);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  struct inode_disk data;
-  block_read (fs_device, inode->sector, &data);
-  inode->length = data.length;
-  inode->direct = data.direct;
-  inode->indirect = data.indirect;
-  inode->double_indirect = data.double_indirect;
-  inode->is_dir = data.is_dir;
-  inode->parent = data.parent;
-  memcpy (&inode->sectors, &data.sectors, 21 * sizeof(block_sector_t));
+  inode->read_end = 0;
+  inode->read_ahead = 0;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->dir_lock);
+  inode->extents = inode->inline_extents;
+  inode->prealloc_cnt = 0;
+  data = malloc (sizeof *data);
+  success = data != NULL;
+  if (success)
+    {
+      cache_read_at (inode->sector, data, 0, BLOCK_SECTOR_SIZE, CACHE_META);
+      inode->length = data->length;
+      inode->is_dir = data->is_dir;
+      inode->parent = data->parent;
+      inode->extent_cnt = data->extent_cnt;
+      inode->extent_block = data->extent_block;
+      memcpy (inode->extents, data->extents, sizeof data->extents);
+      if (inode->extent_block != 0)
+        {
+          success = widen_extents (inode);
+          if (success)
+            cache_read_at (inode->extent_block, inode->extents + INODE_EXTENTS,
+                           0, BLOCK_SECTOR_SIZE, CACHE_META);
+        }
+      free (data);
+    }
+  if (success)
+    {
+      inode->sector_cnt = 0;
+      for (i = 0; i < inode->extent_cnt; i++)
+        inode->sector_cnt += inode->extents[i].length;
+      inode->hint_ext = inode->hint_first = 0;
+    }
+
+  /* Let waiters in.  On failure the last of them frees INODE. */
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  if (!success)
+    {
+      inode->load_failed = true;
+      hash_delete (&open_inodes, &inode->elem);
+      if (--inode->open_cnt == 0)
+        free (inode);
+      inode = NULL;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -384,7 +637,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -395,51 +652,68 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-void inode_update (struct inode *inode);
-
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void
-inode_close (struct inode *inode) 
+inode_close (struct inode *inode)
 {
-  //printf("come to inode_close, what inode? : %d\n", inode->sector);
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
-  
-	inode_update (inode); 
+
+  /* Write back while INODE is still in the table, so a later
+     opener cannot read the header before this update. */
+  if (!inode->removed)
+    {
+      rwlock_acquire_read (&inode->rwlock);
+      inode_update (inode);
+      rwlock_release_read (&inode->rwlock);
+    }
+
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-	//printf(">>>inode %p<<<\n", inode);
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-			//struct list_elem *e;
-			/* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      release_prealloc (inode);
       if (inode->removed)
-      {
-        free_map_release (inode->sector, 1);
-        inode_clear (inode);
-      }
-			/* Deallocate blocks if removed. */
-      /*if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-					for (e = list_begin(inode->data.sector_list); e != list_end(inode->data.sector_list); e = list_next(e)) {
-						struct inode_disk_elem *elem = list_entry(e, struct inode_disk_elem, list_elem);
-						free_map_release (elem->sector, 1);
-					}
+          inode_clear (inode);
         }
-        */
-      //free (inode); 
+      free_extents (inode);
+      free (inode);
     }
+}
+
+/* Deletes the inode just created in SECTOR, releasing every
+   sector it holds, for when it could not be linked into a
+   directory. */
+void
+inode_discard (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
 
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else
+    free_map_release (sector, 1);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
-inode_remove (struct inode *inode) 
+inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
   inode->removed = true;
@@ -449,22 +723,20 @@ inode_remove (struct inode *inode)
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
-	
-	//cache_lock_acquire();
-  while (size > 0) 
+  bool sequential;
+
+  rwlock_acquire_read (&inode->rwlock);
+  sequential = offset == inode->read_end;
+  while (size > 0)
     {
-			static char buf[512];
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-			//printf("inode_read_at: read at sector %d\n", sector_idx);
-
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
@@ -472,166 +744,234 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       /* Number of bytes to actually copy out of this sector. */
       int chunk_size = size < min_left ? size : min_left;
-			//printf("inode_read_at: sector_idx %d chunk_size %d\n", sector_idx, chunk_size);
       if (chunk_size <= 0)
         break;
-      
-			if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-				block_read (fs_device, sector_idx, buffer + bytes_read);
-			}
-			else {
-				if (bounce == NULL) {
-					bounce = malloc(BLOCK_SECTOR_SIZE);
-					if (bounce == NULL)
-						break;
-				}
-				block_read(fs_device, sector_idx, bounce);
-				memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-			}
-      
-
-//			cache_lock_acquire();
-//			void *entry = cache_find (sector_idx);
-//			if (entry == NULL) {
-//				entry = cache_insert (sector_idx);
-//			}
-//			cache_read (entry, buffer + bytes_read, sector_ofs, chunk_size);
-//			cache_lock_release();
-      
+
+      if (sector_idx == HOLE_SECTOR)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size,
+                       inode_cache_type (inode));
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-	//cache_lock_release();
-
-//	block_sector_t sector_idx = byte_to_sector (inode, offset);
-//	if (sector_idx != -1) {
-//		void *entry = cache_find (sector_idx);
-//		if (entry == NULL) {
-//			entry = cache_insert (sector_idx);
-//		}
-//	}
-	free(bounce);	
-//	printf("inode_read_at: bytes_read %d\n", bytes_read);
+
+  /* A read that picks up where the last one ended is likely part
+     of a sequential scan, so start fetching what comes next.
+     Concurrent readers may race on this state, but it is only a
+     hint. */
+  inode->read_end = offset;
+  if (!sequential)
+    inode->read_ahead = 0;
+  else if (bytes_read > 0)
+    {
+      off_t pos = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      off_t end = pos + READ_AHEAD_SECTORS * BLOCK_SECTOR_SIZE;
+
+      if (pos < inode->read_ahead)
+        pos = inode->read_ahead;
+      if (end > inode_length (inode))
+        end = inode_length (inode);
+      for (; pos < end; pos += BLOCK_SECTOR_SIZE)
+        {
+          block_sector_t sector = byte_to_sector (inode, pos);
+          if (sector != HOLE_SECTOR)
+            cache_read_ahead (sector);
+        }
+      if (pos > inode->read_ahead)
+        inode->read_ahead = pos;
+    }
+  rwlock_release_read (&inode->rwlock);
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+                off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+  off_t old_length;
 
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
 
-	//cache_lock_acquire();
-  while (size > 0) 
+  /* Extend the file first; the new part is a hole until the loop
+     below fills it.  If the extent table is full, write as much
+     as did fit. */
+  old_length = inode->length;
+  if (offset + size > inode->length)
+    {
+      off_t capacity;
+
+      inode_grow (inode, bytes_to_sectors (offset + size));
+      capacity = inode->sector_cnt * BLOCK_SECTOR_SIZE;
+      if (offset + size > capacity)
+        size = capacity > offset ? capacity - offset : 0;
+      if (size > 0 && offset + size > inode->length)
+        inode->length = offset + size;
+    }
+
+  while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-			static char buf[512];
       block_sector_t sector_idx = byte_to_sector (inode, offset);
-      //printf("Inode write at sector : %d\n", sector_idx);
 			int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-			
-			if (sector_idx == -1) {
-				int cnt;
-				if (inode_length(inode) % BLOCK_SECTOR_SIZE == 0) {
-					cnt = (offset - inode_length(inode)) / BLOCK_SECTOR_SIZE + 1;
-				}
-				else {
-					cnt = offset / BLOCK_SECTOR_SIZE - inode_length(inode) / BLOCK_SECTOR_SIZE;
-        }
-				
-				if (cnt > 0){
-          //printf("call extend : %d\n", cnt);
-					sector_idx = inode_extend(inode, cnt);
+
+      /* Back a hole with sectors for as much of the rest of the
+         write as possible.  Sectors the write only covers part of
+         are zeroed first; the others are overwritten whole. */
+      if (sector_idx == HOLE_SECTOR)
+        {
+          size_t idx = offset / BLOCK_SECTOR_SIZE;
+          size_t last = (offset + size - 1) / BLOCK_SECTOR_SIZE;
+          size_t cnt;
+
+          sector_idx = inode_allocate (inode, idx, last - idx + 1, &cnt);
+          if (sector_idx == HOLE_SECTOR)
+            break;
+          if (sector_ofs != 0 || size < BLOCK_SECTOR_SIZE)
+            zero_sectors (sector_idx, 1);
+          if (cnt > 1 && idx + cnt - 1 == last
+              && (offset + size) % BLOCK_SECTOR_SIZE != 0)
+            zero_sectors (sector_idx + cnt - 1, 1);
         }
-				else {
-          sector_idx = byte_to_sector (inode, inode->length - 1);
-					//sector_idx = list_entry(list_back(inode->data.sector_list), struct inode_disk_elem, list_elem)->sector;
-				}
-			}
-//			printf("inode_write_at: read at sector %d\n", sector_idx);
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left && inode_left > 0? inode_left : sector_left;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
       int chunk_size = size < min_left ? size : min_left;
-			if (inode_left <= 0) {
-				inode->length += chunk_size - inode_left;
-			}
       if (chunk_size <= 0)
         break;
-      
-			if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-				block_write (fs_device, sector_idx, buffer + bytes_written);
-			}
-			else {
-				if (bounce == NULL) {
-					bounce = malloc(BLOCK_SECTOR_SIZE);
-					if (bounce == NULL)
-						break;
-				}
-				if (sector_ofs > 0 || chunk_size < sector_left)
-					block_read (fs_device, sector_idx, bounce);
-				else
-					memset (bounce, 0, BLOCK_SECTOR_SIZE);
-				memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size)
-;
-				block_write(fs_device, sector_idx, bounce);
-			}
-      
-
-//			cache_lock_acquire();
-//			void *entry = cache_find (sector_idx);
-//			if (entry == NULL) {
-//				entry = cache_insert (sector_idx);
-//			}
-//			cache_write (entry, buffer + bytes_written, sector_ofs, chunk_size);
-
-//			cache_lock_release();
+
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs, chunk_size,
+                      inode_cache_type (inode));
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-	//cache_lock_release();
+
+  /* If the disk filled up, end the file after what was written. */
+  if (size > 0 && inode->length > old_length)
+    inode->length = offset > old_length ? offset : old_length;
 	inode_update(inode);
-	free (bounce);
+  rwlock_release_write (&inode->rwlock);
   return bytes_written;
 }
 
+/* Shrinks INODE to LENGTH bytes, which must not be more than its
+   current length, and releases the sectors past the new end.  The
+   rest of the last sector is zeroed, so growing the file again
+   reads zeros there. */
+void
+inode_truncate (struct inode *inode, off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t keep = bytes_to_sectors (length);
+  size_t i, first;
+
+  rwlock_acquire_write (&inode->rwlock);
+  ASSERT (length <= inode->length);
+  release_prealloc (inode);
+  for (i = first = 0; i < inode->extent_cnt; i++)
+    {
+      struct extent *e = &inode->extents[i];
+      size_t cut;
+
+      if (first + e->length <= keep)
+        {
+          first += e->length;
+          continue;
+        }
+      cut = first + e->length - (first < keep ? keep : first);
+      if (e->start != HOLE_SECTOR)
+        free_map_release (e->start + e->length - cut, cut);
+      first += e->length;
+      e->length -= cut;
+    }
+  while (inode->extent_cnt > 0
+         && inode->extents[inode->extent_cnt - 1].length == 0)
+    inode->extent_cnt--;
+  if (inode->extent_cnt <= INODE_EXTENTS && inode->extent_block != 0)
+    {
+      free_map_release (inode->extent_block, 1);
+      inode->extent_block = 0;
+    }
+  if (inode->sector_cnt > keep)
+    inode->sector_cnt = keep;
+  inode->hint_ext = inode->hint_first = 0;
+
+  if (length % BLOCK_SECTOR_SIZE != 0)
+    {
+      block_sector_t sector = byte_to_sector (inode, length - 1);
+      if (sector != HOLE_SECTOR)
+        cache_write_at (sector, zeros, length % BLOCK_SECTOR_SIZE,
+                        BLOCK_SECTOR_SIZE - length % BLOCK_SECTOR_SIZE,
+                        inode_cache_type (inode));
+    }
+  inode->length = length;
+  if (inode->read_end > length)
+    inode->read_end = length;
+  if (inode->read_ahead > length)
+    inode->read_ahead = length;
+  inode_update (inode);
+  rwlock_release_write (&inode->rwlock);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
-inode_deny_write (struct inode *inode) 
+inode_deny_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void
-inode_allow_write (struct inode *inode) 
+inode_allow_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Acquires INODE's directory lock, which keeps lookups, additions
+   and removals in the directory INODE holds atomic with respect
+   to each other. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -641,195 +981,9 @@ inode_length (const struct inode *inode)
   return inode->length;
 }
 
-block_sector_t
-inode_extend (struct inode *inode, int cnt)
-{
-	//struct inode_disk_elem *elem;
-	static char *zeros;//[BLOCK_SECTOR_SIZE];
-  zeros = calloc (1, BLOCK_SECTOR_SIZE);
-	int i;
-  block_sector_t tmp;
-  struct indirect_inode * indirect;
-  //printf("come to extend : %d, direct : %d\n", cnt, inode->direct);
-  block_sector_t current = bytes_to_sectors (inode->length);
-  // direct extend
-  if (inode->direct == -1){
-    inode->direct = 0;
-    cnt--;
-    if (free_map_allocate (1, &tmp)) {
-      block_write (fs_device, tmp, zeros);
-      inode->sectors[inode->direct] = tmp;
-    }
-  }
-  while (((inode->direct < 15) && (cnt > 0))) {
-    //printf("??? : %d", inode->direct);
-    inode->direct = inode->direct + 1;
-    //printf("??? : %d", current);
-    cnt--;
-    if (free_map_allocate (1, &tmp)) {
-      block_write (fs_device, tmp, zeros);
-      inode->sectors[inode->direct] = tmp;
-    }
-  }
-  //printf("cnt?? : %d\n", cnt);
-  //printf("??? : %d", inode->direct);
-  if (cnt == 0) {
-    //printf("finish");
-    free (zeros);
-    return tmp;
-  }
-  // indirect extend
-  //printf("inode->length : %d\n", inode->length);
-  block_sector_t next_indirect;
-  block_sector_t indirect_idx;
-  if (cnt > 0){
-		int sector_size = bytes_to_sectors(inode->length);
-    next_indirect = sector_size >= 16 ? (sector_size - 16) / 128 : 0;
-    indirect_idx = sector_size >= 16 ? (sector_size - 16) % 128 : 0;
-  }
-  else {
-    next_indirect = 0;
-    indirect_idx = 0;
-  }
-  //printf("next_indirect, indirect_idx : %d, %d\n", next_indirect, indirect_idx);
-  indirect = (struct indirect_inode *)calloc (1, sizeof (struct indirect_inode));
-
-	if (indirect_idx == 0) {
-		if (free_map_allocate (1, &tmp)) {
-			block_write(fs_device, tmp, zeros);
-			inode->sectors[16+next_indirect] = tmp;
-		}
-	}
-
-  if (indirect_idx != 0 && cnt > 0) {
-    inode->indirect = next_indirect + 16;
-    block_read (fs_device, inode->sectors[inode->indirect], indirect);
-    //hex_dump (0, indirect, sizeof(block_sector_t), true);
-    //hex_dump (0, inode->sectors, 21, true);
-  }
-  else if (cnt > 0) {
-    inode->indirect = next_indirect + 16;
-  }
-  while ((inode->indirect < 20) && (cnt > 0)) {
-    
-    if (indirect_idx % 128 == 0 && indirect_idx > 0) {
-      //hex_dump (0, indirect, 128, true);
-      //printf("make indirect inode\n");
-      if (indirect != NULL){
-        //hex_dump (0, indirect, 128, true);
-        block_write (fs_device, inode->sectors[inode->indirect], indirect);
-        free (indirect);
-      }
-      // if we can't add more indirect node, break
-      if (inode->indirect == 19){
-        break;
-      }
-      inode->indirect = inode->indirect + 1;
-      indirect_idx = 0;
-      if (free_map_allocate (1, &tmp)) {
-        block_write (fs_device, tmp, zeros);
-        inode->sectors[inode->indirect] = tmp;
-      }
-      indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-    }
-    // add block sector nums to indirect node
-    if (free_map_allocate (1, &tmp)) { 
-      block_write (fs_device, tmp, zeros);
-      indirect->sectors[indirect_idx] = tmp;
-      //printf("indirect where : %d\n", indirect->sectors[indirect_idx]);
-    }
-    cnt--;
-    indirect_idx++;
-  }
-  // finish in here?
-  if (cnt == 0) {
-    if (indirect != NULL) {
-      //printf("finish in here?\n");
-      //hex_dump (0, indirect, 128 * sizeof(block_sector_t), true);
-      block_write (fs_device, inode->sectors[inode->indirect], indirect);
-      free (indirect);
-    }
-    free (zeros);
-    return tmp;
-  }
-  // double indirect extend
-  next_indirect = (bytes_to_sectors (inode->length) - (16 + 128 * 4)) / 128;
-  block_sector_t next_idx = (bytes_to_sectors (inode->length) - (16 + 128 * 4)) % 128;
-  indirect = (struct indirect_inode *)calloc (1, sizeof (struct indirect_inode));
-  struct indirect_inode *double_indirect = (struct indirect_inode *)calloc (1, sizeof (struct indirect_inode));
-  if (next_indirect == 0 && next_idx == 0){
-    if (free_map_allocate(1, &tmp)) {
-      block_write (fs_device, tmp, zeros);
-      inode->sectors[20] = tmp;
-    }
-    if (free_map_allocate(1, &tmp)) {
-      block_write (fs_device, tmp, zeros);
-      double_indirect->sectors[next_indirect] = tmp;
-    }
-  }
-  // already using double, and left to extend. so we have to read it.
-  if (!(next_indirect == 0 && next_idx == 0) && cnt > 0){
-    inode->double_indirect = 20;
-    block_read (fs_device, inode->sectors[inode->double_indirect], double_indirect);
-  }
-  // already using indirect, and left to extend. so we have to read it.
-  if (!(next_idx == 0) && cnt > 0){
-    block_read (fs_device, double_indirect->sectors[next_indirect], indirect);
-  }
-  while (cnt > 0) {
-    if (next_idx % 128 == 0) {
-      if (indirect != NULL) {
-        block_write (fs_device, double_indirect->sectors[next_indirect], indirect);
-        free (indirect);
-      }
-      next_indirect++;
-      next_idx = 0;
-      if (free_map_allocate (1, &tmp)) {
-        block_write (fs_device, tmp, zeros);
-        double_indirect->sectors[next_indirect] = tmp;
-      }
-      indirect = (struct indirect_inode *)calloc (1, sizeof(struct indirect_inode));
-    }
-    if (free_map_allocate (1, &tmp)) {
-      block_write (fs_device, tmp, zeros);
-      indirect->sectors[next_idx] = tmp;
-    }
-    cnt--;
-    next_idx++;
-  }
-
-  if (cnt == 0) {
-    if (indirect != NULL) {
-      block_write (fs_device, double_indirect->sectors[next_indirect], indirect);
-      free (indirect);
-    }
-    block_write (fs_device, inode->sectors[20], double_indirect);
-    free (double_indirect);
-    free (zeros);
-    return tmp;
-  }
-  free (zeros);
-  return tmp;
-  /*
-	for (i = 0; i < cnt; i++) {
-		elem = malloc(sizeof(struct inode_disk_elem));
-		ASSERT (elem != NULL);
-		if (free_map_allocate (1, &elem->sector)) {
-			block_write (fs_device, elem->sector, zeros);
-			list_push_back (inode->data.sector_list, &elem->list_elem);	
-		}
-		else
-			return -1;
-	}
-	
-	return elem->sector;
-  */
-}
-
 bool
 inode_is_dir (struct inode *inode)
 {
-	//hex_dump(0, inode, sizeof(struct inode), true);
 	return inode != NULL ? inode->is_dir == 1 : false;
 }
 
@@ -839,96 +993,61 @@ inode_is_removed (struct inode *inode)
 	return inode->removed;
 }
 
-void *
+/* Returns the sector of the inode of directory INODE's parent, or
+   0 for the root. */
+block_sector_t
 inode_get_parent (struct inode *inode)
 {
 	ASSERT (inode_is_dir (inode));
 	return inode->parent;
 }
 
+/* Releases every data sector of INODE, and its overflow extent
+   block, to the free map. */
 void
 inode_clear (struct inode *inode)
 {
-  size_t sectors = bytes_to_sectors (inode->length);
-  size_t indirect_sectors = bytes_to_indirect (inode->length);
-  size_t double_indirect_sector = bytes_to_double_indirect (inode->length);
-  block_sector_t idx = 0;
-  while (sectors > 0 && idx < 16) {
-    free_map_release (inode->sectors[idx], 1);
-    idx++;
-    sectors--;
-  }
-  while (sectors > 0 && indirect_sectors > 0 && idx < 20){
-    size_t left = sectors < 128 ? sectors : 128;
-    indirect_clear (inode->sectors[idx], left);
-    sectors -= left;
-    indirect_sectors--;
-    idx++;
-  }
-  if (double_indirect_sector == 1){
-    double_indirect_clear (inode->sectors[20], indirect_sectors, sectors);
-  }
-}
+  size_t i;
 
-void
-indirect_clear (block_sector_t sector, size_t cnt)
-{
-  int i;
-  struct indirect_inode *indirect;
-  indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-  block_read (fs_device, sector, indirect);
-  for (i = 0; i < cnt; i++){
-    free_map_release (indirect->sectors[i], 1);
-  }
-  free_map_release (sector, 1);
+  for (i = 0; i < inode->extent_cnt; i++)
+    if (inode->extents[i].start != HOLE_SECTOR)
+      free_map_release (inode->extents[i].start, inode->extents[i].length);
+  if (inode->extent_block != 0)
+    free_map_release (inode->extent_block, 1);
+  inode->extent_cnt = inode->sector_cnt = 0;
+  inode->extent_block = 0;
 }
 
+/* Marks every sector INODE occupies as in use in the free map.
+   Used when the free map is rebuilt at mount. */
 void
-double_indirect_clear (block_sector_t sector, size_t left_indirect, size_t left_all)
+inode_reserve (struct inode *inode)
 {
-  int i;
-  struct indirect_inode *double_indirect;
-  double_indirect = (struct indirect_inode *)calloc(1, sizeof(struct indirect_inode));
-  block_read (fs_device, sector, double_indirect);
-  for (i = 0; i < left_indirect; i++){
-    size_t left = left_all < 128 ? left_all : 128;
-    indirect_clear (double_indirect->sectors[i], left);
-    left_all -= left;
-  }
-  free_map_release (sector, 1);
-}
+  size_t i;
 
-bool
-get_inode_block (struct inode_disk *disk_inode, char *zeros, int idx) {
-  bool success;
-  block_sector_t tmp;
-  //printf("get direct block, what is idx : %d\n", idx);
-  //hex_dump (zeros, zeros, BLOCK_SECTOR_SIZE, true);
-  if (free_map_allocate (1, &tmp)) {
-    success = true;
-    block_write (fs_device, tmp, zeros);
-    disk_inode->sectors[idx] = tmp;
-    //printf("whar sector? : %d\n", tmp);
-  }
-  else {
-    success = false;
-  }
-  return success;
+  free_map_mark (inode->sector, 1);
+  for (i = 0; i < inode->extent_cnt; i++)
+    if (inode->extents[i].start != HOLE_SECTOR)
+      free_map_mark (inode->extents[i].start, inode->extents[i].length);
+  if (inode->extent_block != 0)
+    free_map_mark (inode->extent_block, 1);
 }
 
 void
 inode_update (struct inode *inode) {
-	struct inode_disk *disk_inode = (struct inode_disk *)malloc(sizeof(struct inode_disk));
+	struct inode_disk *disk_inode = (struct inode_disk *)calloc(1, sizeof(struct inode_disk));
 	ASSERT(disk_inode != NULL);
 
 	disk_inode->length = inode->length;
   disk_inode->magic = INODE_MAGIC;
   disk_inode->is_dir = inode->is_dir;
-  disk_inode->direct = inode->direct;
-  disk_inode->indirect = inode->indirect;
-  disk_inode->double_indirect = inode->double_indirect;
   disk_inode->parent = inode->parent;
-  memcpy (&disk_inode->sectors, &inode->sectors, 21 * sizeof (block_sector_t));
- 	block_write (fs_device, inode->sector, disk_inode);
+  disk_inode->extent_cnt = inode->extent_cnt;
+  disk_inode->extent_block = inode->extent_block;
+  memcpy (disk_inode->extents, inode->extents, sizeof disk_inode->extents);
+ 	cache_write_at (inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE, CACHE_META);
+  if (inode->extent_block != 0)
+    cache_write_at (inode->extent_block, inode->extents + INODE_EXTENTS, 0,
+                    BLOCK_SECTOR_SIZE, CACHE_META);
 	free(disk_inode);
 }
@@ -8,7 +8,7 @@
 struct bitmap;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t, uint32_t, void *);
+bool inode_create (block_sector_t, off_t, uint32_t, block_sector_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -16,16 +16,18 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_truncate (struct inode *, off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
 off_t inode_length (const struct inode *);
 
-void inode_write_behind(struct inode *);
 bool inode_is_dir (struct inode *);
 bool inode_is_removed (struct inode *);
-void * inode_get_parent(struct inode *);
+block_sector_t inode_get_parent (struct inode *);
 void inode_clear (struct inode *);
-void indirect_clear (block_sector_t, size_t);
-void double_indirect_clear (block_sector_t, size_t, size_t);
+void inode_discard (block_sector_t);
+void inode_reserve (struct inode *);
 
 #endif /* filesys/inode.h */
@@ -529,6 +529,9 @@ init_thread (struct thread *t, const char *name, int priority)
 	t->exec_status = false;
 	t->fd_cnt = 2;
 	t->mmap_id = 0;
+	t->exec_file = NULL;
+	list_init(&t->frame_list);
+	list_init(&t->share_list);
 	lock_init(&t->lock_pagedir);
 	lock_init(&t->lock_s_pt);
   t->magic = THREAD_MAGIC;
@@ -18,6 +18,8 @@ enum thread_status
 /* Thread identifier type.
    You can redefine this to whatever type you like. */
 typedef int tid_t;
+
+struct file;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
 /* Thread priorities. */
@@ -119,6 +121,9 @@ struct thread
 
 		uint32_t *s_pt;
 		int mmap_id;
+		struct file *exec_file;			/* Executable, kept open to reload code pages. */
+		struct list frame_list;			/* Private frames owned (vm/frame.c). */
+		struct list share_list;			/* Mappings of shared frames (vm/frame.c). */
 
 		uint32_t *current_dir;
 
@@ -7,6 +7,7 @@
 #include "threads/palloc.h"
 #ifdef VM
 #include "vm/page.h"
+#include "vm/frame.h"
 #endif
 
 static uint32_t *active_pd (void);
@@ -44,7 +45,14 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
+            {
+#ifdef VM
+              /* The zero frame is shared by every process. */
+              if (pte_get_page (*pte) == frame_zero_page ())
+                continue;
+#endif
+              palloc_free_page (pte_get_page (*pte));
+            }
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
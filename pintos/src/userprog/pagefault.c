@@ -19,22 +19,42 @@ page_fault_handler (struct intr_frame *f, bool not_present, bool write UNUSED, b
 {
 //	printf("page fault: tid %d fault addr %p\n", thread_current()->tid, fault_addr);
 
-	if (!is_user_vaddr (fault_addr) || fault_addr == NULL || !not_present) {
+	if (!is_user_vaddr (fault_addr) || fault_addr == NULL) {
 		bad_exit(f);
 	}
+	else if (!not_present) {												// Write to a read-only page
+		struct s_page_entry *s_pte;
+		void *kpage;
+
+		s_pte = page_lookup (pg_round_down(fault_addr), NULL);
+		if (!write || s_pte == NULL || !s_pte->zero_mapped || !s_pte->writable)
+			bad_exit(f);
+
+		/* First write to a zero page: copy on write, and since the
+		   source is all zeros the copy is just a zeroed frame. */
+		lock_acquire_ft();
+		kpage = frame_get_page(true);
+		page_unshare_zero(s_pte, kpage);
+		set_frame_entry((void *) s_pte->upage, kpage);
+		lock_release_ft();
+	}
 	else {																					// In Project 3-1, this case will be related to stack growth
 		void *fault_page;
 		struct s_page_entry *s_pte;
 
 		fault_page = pg_round_down(fault_addr);
 		
-		s_pte = page_lookup (fault_page, thread_current()->tid);
+		s_pte = page_lookup (fault_page, NULL);
 		
 		if (s_pte != NULL) {													// Swapped
-			if (s_pte->is_swapped){
+			if (s_pte->is_swapped && !write && page_is_zero_fill(s_pte)) {
+				page_map_zero(s_pte);
+			}
+			else if (s_pte->is_swapped){
 				//printf("Let's swap in\n");
 				lock_acquire_ft();
-				swap_in(s_pte, s_pte->upage);
+				swap_in(s_pte, (void *) s_pte->upage);
+				swap_in_around(s_pte);
 				lock_release_ft();
 			}
 			else {
@@ -48,29 +68,26 @@ page_fault_handler (struct intr_frame *f, bool not_present, bool write UNUSED, b
 				bad_exit(f);
 			}
 			
-			while (pagedir_get_page (t->pagedir, fault_page) == NULL && page_lookup(fault_page, thread_current()->tid) == NULL) {
-				lock_acquire_ft();	
-				kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-	
-				if (kpage == NULL){
-					kpage = frame_evict();
-				}
-	
-				if (pagedir_get_page (t->pagedir, fault_page) == NULL) {
-					if (!pagedir_set_page (t->pagedir, fault_page, kpage, true)) {
-						PANIC ("page_fault_handler: pagedir_set_page failed");	
-					}
+			/* Grow the stack over the whole gap in one pass under a
+			   single acquisition of the frame table lock. */
+			lock_acquire_ft();
+			while (pagedir_get_page (t->pagedir, fault_page) == NULL && page_lookup(fault_page, NULL) == NULL) {
+				/* New stack pages read the zero frame until written. */
+				if (!write) {
+					page_insert (fault_page, true);
+					page_map_zero (page_lookup (fault_page, t));
+					fault_page += PGSIZE;
+					continue;
 				}
-				else {
-					PANIC ("page_fault_handler: upage is already mapped");
+
+				kpage = frame_get_page(true);
+				if (!pagedir_set_page (t->pagedir, fault_page, kpage, true)) {
+					PANIC ("page_fault_handler: pagedir_set_page failed");	
 				}
-				
 				set_frame_entry (fault_page, kpage);
-				//page_insert (fault_page, true);
-				//printf("thread %d upage %p -> kpage %p\n", thread_current()->tid, fault_page, kpage);
-				lock_release_ft();
 				fault_page += PGSIZE;
 			}
+			lock_release_ft();
 		}
 	}
 }
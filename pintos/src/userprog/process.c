@@ -134,20 +134,27 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd, *pt;
 
+	/* Untrack our frames first so that no other process picks one
+	   of them for eviction while the page tables go away. */
+	if (cur->pagedir != NULL) {
+		lock_acquire_ft();
+		remove_frame_entry (cur, NULL);
+		lock_release_ft();
+	}
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
-	//printf("thread %d destroy supplemental page table\n", thread_current()->tid);
 	pt = cur->s_pt;
 	if (pt != NULL)
 	{
 		cur->s_pt = NULL;
-		remove_page_block_sector(pt);
+		page_free_swap_slots((struct hash *) pt);
 
 		s_page_table_destroy (pt);
 	}
 			
-	//printf("thread %d modify frame table\n", thread_current()->tid);
-  remove_frame_entry (cur->tid, NULL);
+	file_close (cur->exec_file);
+	cur->exec_file = NULL;
 	//printf("thread %d destroy pagedir\n", thread_current()->tid);
   pd = cur->pagedir;
   if (pd != NULL) 
@@ -405,7 +412,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
 	palloc_free_page (tok_p_arr);
-  file_close (file);
+	if (success) {
+		/* Its read-only pages may be shared with other processes,
+		   so the executable must not change while we run. */
+		file_deny_write (file);
+		t->exec_file = file;
+	}
+	else
+		file_close (file);
 	
   return success;
 }
@@ -471,8 +485,12 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
-   Return true if successful, false if a memory allocation error
-   or disk read error occurs. */
+   Nothing is read here: each page is only recorded in the
+   supplemental page table and filled in by the page fault
+   handler on first access.
+
+   Return true if successful, false if a page is already
+   mapped. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -480,8 +498,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
-  file_seek (file, ofs);
-	
+
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -489,41 +506,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-			
-      /* Get a page of memory. */
-      uint8_t *kpage = palloc_get_page (PAL_USER);
-			lock_acquire_ft();
-			if (kpage == NULL){
-				kpage = frame_evict();
-			}
-      if (kpage == NULL) {
-				lock_release_ft();
+
+      if (!segment_insert (upage, writable, file, ofs, page_read_bytes))
         return false;
-			}
-      /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
-        {
-          palloc_free_page (kpage);
-          return false; 
-        }
-			
-			memset (kpage + page_read_bytes, 0, page_zero_bytes);
-			
-      /* Add the page to the process's address space. */
-			lock_acquire_pagedir(NULL);
-      if (!install_page (upage, kpage, writable)) 
-        {
-          palloc_free_page (kpage);
-					lock_release_pagedir(NULL);
-					lock_release_ft();
-          return false; 
-        }
-			lock_release_pagedir(NULL);
-			lock_release_ft();
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += PGSIZE;
       upage += PGSIZE;
     }
   return true;
@@ -536,11 +526,10 @@ setup_stack (void **esp)
 {
   uint8_t *kpage;
   bool success = false;
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+	/* The arguments are pushed right away, so the first stack
+	   page gets a private frame rather than the zero frame. */
 	lock_acquire_ft();
-	if (kpage == NULL) {
-		kpage = frame_evict();
-	}
+  kpage = frame_get_page (true);
   if (kpage != NULL) 
     {
 			lock_acquire_pagedir(NULL);
@@ -30,14 +30,12 @@ bool is_valid_uaddr (void *);
 bool is_in_uspace (void *);
 bool is_mapped_uaddr (void *);
 
-struct lock lock;
 struct intr_frame *_f;
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-	lock_init(&lock);
 }
 
 static void
@@ -85,9 +83,7 @@ syscall_handler (struct intr_frame *f)
 
 		case SYS_EXEC:
 			if (is_valid_uaddr (*(void **)p)) {
-				lock_acquire(&lock);
 				f->eax =  process_execute (*(char **)p);
-				lock_release(&lock);
 			}
 			else {
 				bad_exit(f);
@@ -100,10 +96,8 @@ syscall_handler (struct intr_frame *f)
 
 		case SYS_CREATE:
 			if (is_valid_uaddr (*(void **)p)) {
-				lock_acquire(&lock);
 				//printf("create_handler: create file %s\n", *(char **)p);
 				f->eax = filesys_create (*(char **)p, *(off_t *)(p+sizeof(char **)));
-				lock_release(&lock);
 			}
 			else {
 				bad_exit(f);
@@ -121,9 +115,7 @@ syscall_handler (struct intr_frame *f)
 
 		case SYS_OPEN:
 			if (is_valid_uaddr (*(void **)p)) {
-				lock_acquire(&lock);
 				temp = open_handler(*(char **)p);
-				lock_release(&lock);
 				if (temp == 0 || temp == 1) {
 					bad_exit(f);
 				}
@@ -147,9 +139,7 @@ syscall_handler (struct intr_frame *f)
 		case SYS_READ:
 			if (*(int *)p != 1) {
 				if (is_valid_uaddr (*(void **)(p+sizeof(int))) && is_valid_uaddr ((void *)(p+sizeof(int)+sizeof(void *)))) {
-					lock_acquire(&lock);
 						temp = read_handler (*(int *)p, *(void **)(p+sizeof(int)), *(unsigned *)(p+sizeof(int)+sizeof(void *)));
-						lock_release(&lock);
 						if (temp == -1) {
 							bad_exit(f);
 						}
@@ -182,9 +172,7 @@ syscall_handler (struct intr_frame *f)
 			}
 			else {
 				if (is_valid_uaddr ((void *)(p+sizeof(int))) && is_valid_uaddr (*(void **)(p+sizeof(int))) && is_valid_uaddr ((void *)(p+sizeof(int)+sizeof(void *)))) {
-					lock_acquire(&lock);
 					temp = write_handler (*(int *)p, *(void **)(p+sizeof(int)), *(unsigned *)(p+sizeof(int)+sizeof(void*)));
-					lock_release(&lock);
 					if (temp == -1) {
 						bad_exit(f);
 					}
@@ -310,12 +298,18 @@ filesize_handler(int fd)
 	return size;
 }
 
+/* File data is copied between user buffers and a kernel bounce
+   page, never directly under file system locks: a fault on a user
+   page there may have to evict a frame to a file, which takes
+   those locks itself. */
+
 int
 read_handler (int fd, void *buffer, unsigned size)
 {
 	unsigned _size = size;
 	void *p = buffer;
 	struct file_info *finfo;
+	void *bounce;
 	int result = 0;
 
 	if (fd == 0) {
@@ -335,12 +329,29 @@ read_handler (int fd, void *buffer, unsigned size)
 			if (inode_is_dir(file_get_inode(finfo->file_p)))
 				return -1;
 
+			/* Fault the buffer in and break zero page sharing up
+			   front, so the copies below rarely fault. */
 			for (i = 0; i < pages ; i++) {
+				struct s_page_entry *s_pte;
 				if (pagedir_get_page(thread_current()->pagedir, buffer + i*PGSIZE) == NULL) {
-					page_fault_handler (_f, true, false, true, buffer + i*PGSIZE);
+					page_fault_handler (_f, true, true, true, buffer + i*PGSIZE);
 				}
+				s_pte = page_lookup (pg_round_down (buffer + i*PGSIZE), NULL);
+				if (s_pte != NULL && s_pte->zero_mapped)
+					page_fault_handler (_f, false, true, true, buffer + i*PGSIZE);
+			}
+			bounce = palloc_get_page (0);
+			if (bounce == NULL)
+				return -1;
+			while ((unsigned) result < size) {
+				int chunk = size - result < PGSIZE ? size - result : PGSIZE;
+				int n = file_read (finfo->file_p, bounce, chunk);
+				memcpy (buffer + result, bounce, n);
+				result += n;
+				if (n < chunk)
+					break;
 			}
-			result = file_read(finfo->file_p, buffer, size);
+			palloc_free_page (bounce);
 			return result;
 		}
 
@@ -353,7 +364,8 @@ write_handler (int fd, const void *buffer, unsigned size)
 {
 	struct file_info *finfo;
 	int pages = DIV_ROUND_UP(size + 1, PGSIZE), i;
-	int result;
+	void *bounce;
+	int result = 0;
 	finfo = find_opened_file_info(fd, thread_current());
 	if (finfo != NULL) {
 		if (inode_is_dir(file_get_inode(finfo->file_p)))
@@ -363,7 +375,19 @@ write_handler (int fd, const void *buffer, unsigned size)
 			if (pagedir_get_page(thread_current()->pagedir, buffer + i*PGSIZE) == NULL)
 				page_fault_handler (_f, true, true, true, buffer + i*PGSIZE);
 		}
-		result = file_write (finfo->file_p, buffer, size);
+		bounce = palloc_get_page (0);
+		if (bounce == NULL)
+			return -1;
+		while ((unsigned) result < size) {
+			int chunk = size - result < PGSIZE ? size - result : PGSIZE;
+			int n;
+			memcpy (bounce, buffer + result, chunk);
+			n = file_write (finfo->file_p, bounce, chunk);
+			result += n;
+			if (n < chunk)
+				break;
+		}
+		palloc_free_page (bounce);
 		return result;
 	}
 
@@ -449,7 +473,11 @@ readdir_handler (int fd, char *name)
 	struct file_info *finfo;
 	finfo = find_opened_file_info (fd, thread_current());
 	if (finfo != NULL && finfo->dir != NULL) {
-		return dir_readdir(finfo->dir, name);
+		char entry[NAME_MAX + 1];
+		if (!dir_readdir(finfo->dir, entry))
+			return false;
+		strlcpy (name, entry, sizeof entry);
+		return true;
 	}
 	else
 		return false;
@@ -473,7 +501,8 @@ is_in_uspace (void *p)
 bool
 is_mapped_uaddr (void *p)
 {
-	return pagedir_get_page (thread_current()->pagedir, p) != NULL;
+	return pagedir_get_page (thread_current()->pagedir, p) != NULL
+		|| page_lookup (pg_round_down (p), NULL) != NULL;
 }
 
 struct file_info *
@@ -1,5 +1,6 @@
 #include "vm/frame.h"
 #include <stdio.h>
+#include <string.h>
 #include <bitmap.h>
 #include <round.h>
 #include <debug.h>
@@ -7,6 +8,9 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/loader.h"
+#include "userprog/pagedir.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
 #include "userprog/syscall.h"
 #include "vm/swap.h"
 #include "devices/block.h"
@@ -14,21 +18,65 @@
 struct frame_entry
 {
 	bool in_use;
-	tid_t tid;
+	struct thread *owner;					/* Valid while in the clock ring. */
 	void *upage;
+	struct list_elem elem;				/* Element in the clock ring. */
+	struct list_elem owner_elem;	/* Element in owner's frame_list. */
+	struct share_entry *share;	/* Non-null if shared read-only. */
+	size_t ref_cnt;							/* Number of page tables mapping it. */
+};
+
+/* A read-only executable page mapped into several processes from a
+   single frame, keyed by the executable's inode, file offset and the
+   number of bytes read from the file, since the rest of the page is
+   zeroed. */
+struct share_entry
+{
+	struct hash_elem hash_elem;
+	block_sector_t inode_sector;
+	off_t ofs;
+	size_t read_bytes;
+	void *kpage;
+	struct list mappings;				/* List of struct share_mapping. */
+};
+
+/* One process's mapping of a shared frame. */
+struct share_mapping
+{
 	struct list_elem elem;
+	struct list_elem owner_elem;	/* Element in owner's share_list. */
+	struct thread *owner;
+	void *upage;
 };
 
 struct frame_table
 {
 	struct lock lock;
 	struct list entry_list;
+	struct list_elem *hand;			/* Clock hand into entry_list. */
+	size_t frame_cnt;						/* Number of frames in entry_list. */
+	struct hash shared;					/* Shared executable pages. */
 	size_t user_pages;
 	uint8_t *base;
 };
 
 static struct frame_table *ft;
 
+/* Page of zeros mapped read-only for untouched zero-filled pages.
+   It comes from the kernel pool and is never evicted. */
+static void *zero_frame;
+
+static struct frame_entry *frame_lookup(void *kpage);
+static void *frame_kpage(struct frame_entry *);
+static bool share_key(struct s_page_entry *, struct share_entry *);
+static bool share_test_accessed(struct share_entry *, bool clear);
+static void share_evict(struct frame_entry *);
+static void share_unmap(struct frame_entry *, struct share_mapping *);
+static void frame_release(struct frame_entry *);
+static unsigned share_hash(const struct hash_elem *, void *);
+static bool share_less(const struct hash_elem *, const struct hash_elem *, void *);
+static struct frame_entry *clock_advance(void);
+static struct frame_entry *clock_select_victim(void);
 static void hex_dump_at_frame_table(void);
 static void hex_dump_at_user_pool_base(void);
 
@@ -53,9 +101,15 @@ frame_table_init (size_t user_page_limit)
 	ft = palloc_get_multiple(0, table_pages);
 	lock_init(&ft->lock);
 	list_init(&ft->entry_list);
+	ft->hand = NULL;
+	ft->frame_cnt = 0;
+	if (!hash_init(&ft->shared, share_hash, share_less, NULL))
+		PANIC ("frame_table_init: hash init failed");
 	ft->user_pages = user_pages - bm_pages;
 	ft->base = palloc_get_multiple(PAL_ZERO, data_pages);
 
+	zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+
 	user_pool_base = free_start + kernel_pages * PGSIZE + bm_pages * PGSIZE;		// cf. init_pool (userprog/process.c)
 
 }
@@ -66,11 +120,8 @@ frame_table_init (size_t user_page_limit)
 bool
 set_frame_entry (void *upage, void *kpage)
 {
-	uintptr_t idx;
 	struct frame_entry* entry;
 
-	//printf("set frame entry: tid %d upage %p kpage %p\n", thread_current()->tid, upage, kpage);
-
 	if (pg_ofs(upage) != 0) {
 		printf("upage is not a page address!\n");
 		return false;
@@ -80,78 +131,356 @@ set_frame_entry (void *upage, void *kpage)
 		return false;
 	}
 	
-	idx = pg_no(kpage) - pg_no(user_pool_base);
-	entry = (struct frame_entry*) ((uintptr_t)(ft->base) + idx * sizeof(struct frame_entry));
+	entry = frame_lookup(kpage);
 	if (entry->in_use){
 		return false;
 	}
 	entry->in_use = true;
-	entry->tid = thread_current()->tid;
+	entry->owner = thread_current();
 	entry->upage = upage;
+	entry->share = NULL;
+	entry->ref_cnt = 1;
 	list_push_back (&ft->entry_list, &entry->elem);
+	list_push_back (&thread_current()->frame_list, &entry->owner_elem);
+	ft->frame_cnt++;
 	
 	return true;
 }
 
+/* Returns a free user frame, evicting one if the pool is empty, and
+   zeroes it if ZERO.  The caller must hold the frame table lock. */
+void *
+frame_get_page(bool zero)
+{
+	void *kpage = palloc_get_page(PAL_USER | (zero ? PAL_ZERO : 0));
+
+	if (kpage == NULL) {
+		kpage = frame_evict();
+		if (kpage != NULL && zero)
+			memset(kpage, 0, PGSIZE);
+	}
+	return kpage;
+}
+
+void *
+frame_zero_page()
+{
+	return zero_frame;
+}
+
+static struct frame_entry *
+frame_lookup(void *kpage)
+{
+	return (struct frame_entry *) ft->base + (pg_no(kpage) - pg_no(user_pool_base));
+}
+
+static void *
+frame_kpage(struct frame_entry *entry)
+{
+	return (uint8_t *) user_pool_base + (entry - (struct frame_entry *) ft->base) * PGSIZE;
+}
+
+/* Stores the shared-page key of S_PTE into SE.  Only pages of
+   read-only executable segments that are not in swap can be
+   shared. */
+static bool
+share_key(struct s_page_entry *s_pte, struct share_entry *se)
+{
+	if (s_pte->writable || s_pte->file_p == NULL || s_pte->mapping >= 0
+			|| s_pte->swap_slot != SWAP_SLOT_NONE)
+		return false;
+
+	se->inode_sector = inode_get_inumber(file_get_inode(s_pte->file_p));
+	se->ofs = s_pte->page_idx * PGSIZE;
+	se->read_bytes = s_pte->page_read_bytes;
+	return true;
+}
+
+/* If another process already has S_PTE's executable page in a
+   frame, maps that frame into the current process and returns
+   true.  The caller must hold the frame table lock. */
+bool
+frame_share_in(struct s_page_entry *s_pte)
+{
+	struct share_entry key, *se;
+	struct share_mapping *m;
+	struct hash_elem *e;
+
+	if (!share_key(s_pte, &key))
+		return false;
+	e = hash_find(&ft->shared, &key.hash_elem);
+	if (e == NULL)
+		return false;
+	se = hash_entry(e, struct share_entry, hash_elem);
+
+	m = malloc(sizeof(struct share_mapping));
+	if (m == NULL)
+		return false;
+	m->owner = thread_current();
+	m->upage = (void *) s_pte->upage;
+	list_push_back(&se->mappings, &m->elem);
+	list_push_back(&thread_current()->share_list, &m->owner_elem);
+	frame_lookup(se->kpage)->ref_cnt++;
+
+	page_swap_in(s_pte, se->kpage);
+	return true;
+}
+
+/* Offers KPAGE, just filled with S_PTE's executable page and
+   registered for the current process, for sharing with other
+   processes.  The caller must hold the frame table lock. */
+void
+frame_share_add(struct s_page_entry *s_pte, void *kpage)
+{
+	struct frame_entry *entry = frame_lookup(kpage);
+	struct share_entry *se;
+	struct share_mapping *m;
+
+	se = malloc(sizeof(struct share_entry));
+	m = malloc(sizeof(struct share_mapping));
+	if (se == NULL || m == NULL || !share_key(s_pte, se)) {
+		free(se);
+		free(m);
+		return;
+	}
+	se->kpage = kpage;
+	list_init(&se->mappings);
+	m->owner = entry->owner;
+	m->upage = entry->upage;
+	list_push_back(&se->mappings, &m->elem);
+	hash_insert(&ft->shared, &se->hash_elem);
+	entry->share = se;
+
+	/* The frame is now reached through the mapping. */
+	list_remove(&entry->owner_elem);
+	list_push_back(&thread_current()->share_list, &m->owner_elem);
+}
+
+/* Returns true if any process sharing SE has accessed it, clearing
+   the accessed bits if CLEAR. */
+static bool
+share_test_accessed(struct share_entry *se, bool clear)
+{
+	struct list_elem *e;
+	struct share_mapping *m;
+	struct thread *t;
+	bool accessed = false;
+
+	for (e = list_begin(&se->mappings); e != list_end(&se->mappings); e = list_next(e)) {
+		m = list_entry(e, struct share_mapping, elem);
+		t = m->owner;
+		if (pagedir_is_accessed(t->pagedir, m->upage)) {
+			accessed = true;
+			if (clear)
+				pagedir_set_accessed(t->pagedir, m->upage, false);
+		}
+	}
+	return accessed;
+}
+
+/* Unmaps shared frame ENTRY from every process using it.  The page
+   is read-only, so nothing needs to be written. */
+static void
+share_evict(struct frame_entry *entry)
+{
+	struct share_entry *se = entry->share;
+	struct share_mapping *m;
+
+	while (!list_empty(&se->mappings)) {
+		m = list_entry(list_pop_front(&se->mappings), struct share_mapping, elem);
+		list_remove(&m->owner_elem);
+		page_get_evicted(page_lookup(m->upage, m->owner));
+		free(m);
+	}
+	hash_delete(&ft->shared, &se->hash_elem);
+	free(se);
+	entry->share = NULL;
+	entry->ref_cnt = 0;
+}
+
+/* Drops mapping M of shared frame ENTRY, clearing the page table
+   entry so that pagedir_destroy() leaves the frame alone.  Frees
+   the frame with the last reference. */
+static void
+share_unmap(struct frame_entry *entry, struct share_mapping *m)
+{
+	struct share_entry *se = entry->share;
+	struct thread *t = m->owner;
+
+	list_remove(&m->elem);
+	list_remove(&m->owner_elem);
+	lock_acquire_pagedir(t);
+	pagedir_clear_page(t->pagedir, m->upage);
+	lock_release_pagedir(t);
+	free(m);
+
+	if (--entry->ref_cnt > 0)
+		return;
+	hash_delete(&ft->shared, &se->hash_elem);
+	free(se);
+	entry->share = NULL;
+	frame_release(entry);
+	palloc_free_page(frame_kpage(entry));
+}
+
+/* Takes ENTRY out of the clock ring.  It stays in its owner's list
+   unless the caller removes it. */
+static void
+frame_release(struct frame_entry *entry)
+{
+	if (ft->hand == &entry->elem)
+		ft->hand = list_next(ft->hand);
+	list_remove(&entry->elem);
+	entry->in_use = false;
+	ft->frame_cnt--;
+}
+
+/* Returns the frame under the clock hand and moves the hand one
+   frame forward, wrapping around at the end of the list. */
+static struct frame_entry *
+clock_advance()
+{
+	struct list_elem *e;
+
+	if (ft->hand == NULL || ft->hand == list_end(&ft->entry_list))
+		ft->hand = list_begin(&ft->entry_list);
+	e = ft->hand;
+	ft->hand = list_next(e);
+	return list_entry(e, struct frame_entry, elem);
+}
+
+/* Picks a frame to evict with the enhanced clock algorithm.  Each
+   sweep first looks for a frame that is neither accessed nor dirty
+   without touching any bits, then for one that is merely not
+   accessed, clearing accessed bits as it goes.  The second sweep
+   clears every accessed bit, so four sweeps always find a victim. */
+static struct frame_entry *
+clock_select_victim()
+{
+	struct frame_entry *entry;
+	struct thread *t;
+	size_t cnt = ft->frame_cnt, i;
+	int pass;
+	bool accessed, dirty;
+
+	for (pass = 0; pass < 4; pass++) {
+		for (i = 0; i < cnt; i++) {
+			entry = clock_advance();
+			if (entry->share != NULL) {
+				if (!share_test_accessed(entry->share, pass % 2 == 1))
+					return entry;
+				continue;
+			}
+			t = entry->owner;
+
+			accessed = pagedir_is_accessed(t->pagedir, entry->upage);
+			dirty = pagedir_is_dirty(t->pagedir, entry->upage);
+			if (pass % 2 == 0) {
+				if (!accessed && !dirty)
+					return entry;
+			}
+			else {
+				if (!accessed)
+					return entry;
+				pagedir_set_accessed(t->pagedir, entry->upage, false);
+			}
+		}
+	}
+	return clock_advance();
+}
+
+/* Evicts a user frame and returns it.  The caller must hold the
+   frame table lock.  Only dirty pages cost a write: mmap pages go
+   back to their file, everything else to swap.  A clean page is
+   dropped when its swap slot or executable still holds a copy. */
 void *
 frame_evict()
 {
 	struct frame_entry *entry;
 	struct s_page_entry *page_entry;
-	struct sector_elem *sector_elem;
 	struct thread *t;
 	void *upage, *kpage;
-	uintptr_t idx;
-	int cnt = PGSIZE / BLOCK_SECTOR_SIZE, i;
+	bool dirty;
 	
 	if (list_empty(&ft->entry_list)) {
 		return palloc_get_page(PAL_USER);
 	}
 	else {
-		entry = list_entry(list_pop_front (&ft->entry_list), struct frame_entry, elem);
-		entry->in_use = false;
+		entry = clock_select_victim();
+		frame_release(entry);
 	
+		kpage = frame_kpage(entry);
+		if (entry->share != NULL) {
+			share_evict(entry);
+			return kpage;
+		}
+		list_remove(&entry->owner_elem);
+
 		upage = entry->upage;
 		
-		idx = ((uintptr_t)entry - (uintptr_t)(ft->base)) / sizeof(struct frame_entry);
-		kpage = user_pool_base + idx * PGSIZE;
-		
-		//hex_dump_at_user_pool_base();
-		t = find_thread(entry->tid);
-		page_entry = page_lookup(upage, entry->tid);
+		t = entry->owner;
+		page_entry = page_lookup(upage, t);
+
+		/* Unmap first so the owner cannot modify the page while it
+		   is being written out; its fault waits on the frame lock.
+		   Only then is the dirty bit final. */
+		dirty = page_get_evicted(page_entry);
 	
-		if (page_entry->file_p == NULL || page_entry->mapping < 0) {		
-			for (i = 0; i < cnt; i++){
-				sector_elem = malloc(sizeof(struct sector_elem));
-				sector_elem->sector = swap_out(kpage + i*BLOCK_SECTOR_SIZE);
-				list_push_back(&page_entry->sector_list, &sector_elem->list_elem);
-			}
+		if (page_entry->mapping >= 0) {
+			if (dirty)
+				file_write_at(page_entry->file_p, kpage, page_entry->page_read_bytes, page_entry->page_idx * PGSIZE);
 		}
-		else {
-			file_seek(page_entry->file_p, page_entry->page_idx * PGSIZE);
-			file_write(page_entry->file_p, page_entry->upage, page_entry->page_read_bytes);
-			file_seek(page_entry->file_p, 0);
+		else if (dirty || (page_entry->swap_slot == SWAP_SLOT_NONE && page_entry->file_p == NULL)) {
+			swap_out(page_entry, kpage);
 		}
-		page_get_evicted(page_entry);
-		//hex_dump_at_user_pool_base();
 	
-		//printf("frame evict: tid %d upage %p kpage %p\n", entry->tid, upage, kpage);
 		return kpage;
 	}
 }
 
+/* Stops tracking process T's frame mapped at UPAGE, or all of its
+   frames if UPAGE is null, in time proportional to the number of
+   pages removed.  Private frames stay mapped and are freed by
+   pagedir_destroy() or the caller; shared frames are unmapped and
+   freed here.  The caller must hold the frame table lock. */
 void
-remove_frame_entry (tid_t t, void *upage){
-	struct list_elem *e;
+remove_frame_entry (struct thread *t, void *upage)
+{
 	struct frame_entry *entry;
-	lock_acquire_ft();
-	for (e = list_begin(&ft->entry_list); e != list_end(&ft->entry_list); e = list_next(e)) {
-		entry = list_entry (e, struct frame_entry, elem);
-		if (entry->tid == t && (upage == NULL || entry->upage == upage)){
-			list_remove (&entry->elem);
+	struct share_mapping *m;
+	void *kpage;
+
+	if (upage != NULL) {
+		kpage = pagedir_get_page(t->pagedir, upage);
+		if (kpage != NULL && kpage != zero_frame) {
+			entry = frame_lookup(kpage);
+			if (entry->share == NULL) {
+				frame_release(entry);
+				list_remove(&entry->owner_elem);
+			}
+			else {
+				struct list_elem *e;
+				for (e = list_begin(&entry->share->mappings); e != list_end(&entry->share->mappings); e = list_next(e)) {
+					m = list_entry(e, struct share_mapping, elem);
+					if (m->owner == t && m->upage == upage) {
+						share_unmap(entry, m);
+						break;
+					}
+				}
+			}
+		}
+	}
+	else {
+		while (!list_empty(&t->frame_list)) {
+			entry = list_entry(list_front(&t->frame_list), struct frame_entry, owner_elem);
+			frame_release(entry);
+			list_remove(&entry->owner_elem);
+		}
+		while (!list_empty(&t->share_list)) {
+			m = list_entry(list_front(&t->share_list), struct share_mapping, owner_elem);
+			share_unmap(frame_lookup(pagedir_get_page(t->pagedir, m->upage)), m);
 		}
 	}
-	lock_release_ft();
 }
 
 void
@@ -180,3 +509,23 @@ hex_dump_at_user_pool_base()
 	hex_dump((uintptr_t)user_pool_base, user_pool_base, PGSIZE * 4, false);
 	printf("\n");
 }
+
+static unsigned
+share_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+	const struct share_entry *se = hash_entry(e, struct share_entry, hash_elem);
+	return hash_int(se->inode_sector) ^ hash_int(se->ofs) ^ hash_int(se->read_bytes);
+}
+
+static bool
+share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+	const struct share_entry *a_ = hash_entry(a, struct share_entry, hash_elem);
+	const struct share_entry *b_ = hash_entry(b, struct share_entry, hash_elem);
+
+	if (a_->inode_sector != b_->inode_sector)
+		return a_->inode_sector < b_->inode_sector;
+	if (a_->ofs != b_->ofs)
+		return a_->ofs < b_->ofs;
+	return a_->read_bytes < b_->read_bytes;
+}
@@ -3,12 +3,18 @@
 #include "threads/thread.h"
 #include "threads/synch.h"
 
+struct s_page_entry;
+
 void *user_pool_base;
 
 void frame_table_init (size_t user_page_limit);
 bool set_frame_entry (void *upage, void *kpage);
 void *frame_evict(void);
-void remove_frame_entry (tid_t t, void*);
+void *frame_get_page (bool zero);
+void *frame_zero_page (void);
+bool frame_share_in (struct s_page_entry *);
+void frame_share_add (struct s_page_entry *, void *kpage);
+void remove_frame_entry (struct thread *, void *);
 
 void lock_acquire_ft(void);
 void lock_release_ft(void);
@@ -41,11 +41,12 @@ unmap_action (struct hash_elem *e, void *aux)
 {
 	struct s_page_entry *entry = hash_entry(e, struct s_page_entry, hash_elem);
 	if (entry->file_p != NULL && entry->mapping >= 0) {
-		if (!entry->is_swapped) {
-			file_seek(entry->file_p, entry->page_idx * PGSIZE);
-			file_write(entry->file_p, entry->upage, entry->page_read_bytes);
-			file_seek(entry->file_p, 0);
-		}
+		/* Only pages written since they were read back need to go
+		   to the file.  The page directory still maps them here. */
+		if (!entry->is_swapped
+		    && pagedir_is_dirty(thread_current()->pagedir, entry->upage))
+			file_write_at(entry->file_p, entry->upage, entry->page_read_bytes,
+			              entry->page_idx * PGSIZE);
 	}
 }
 
@@ -62,22 +63,36 @@ page_insert (const void *vaddr, bool writable)
 		PANIC ("page_insert: out of memory (s_page_entry)");
 
 	p->upage = vaddr;
-	p->tid = thread_current()->tid;
+	p->owner = thread_current();
 	p->is_swapped = false;
-	list_init(&p->sector_list);
+	p->zero_mapped = false;
+	p->swap_slot = SWAP_SLOT_NONE;
 	p->file_p = NULL;
 	p->mapping = -1;
 	p->writable = writable;
 	
+	/* Pages brought in from swap or a file already have an entry. */
 	lock_acquire_s_pt(NULL);
-	hash_insert((struct hash *)(thread_current()->s_pt), &p->hash_elem);
+	if (hash_insert((struct hash *)(thread_current()->s_pt), &p->hash_elem) != NULL)
+		free(p);
 	lock_release_s_pt(NULL);
 }
 
+/* Records a not-yet-loaded executable page at VADDR that holds
+   READ_BYTES bytes of FILE from offset OFS followed by zeros.  It
+   is read in by the page fault handler on first access, and a
+   clean copy can later be dropped and read again. */
+bool
+segment_insert (const void *vaddr, bool writable, struct file *file, off_t ofs, size_t read_bytes)
+{
+	ASSERT (ofs % PGSIZE == 0);
+	return mmap_insert(vaddr, writable, file, -1, ofs / PGSIZE, read_bytes);
+}
+
 bool
 mmap_insert (const void *vaddr, bool writable, struct file *file_p, int mapping, size_t page_idx,  size_t page_read_bytes)
 {
-	if (pg_ofs(vaddr) != 0 || page_lookup(vaddr, thread_current()->tid) != NULL)
+	if (pg_ofs(vaddr) != 0 || page_lookup(vaddr, NULL) != NULL)
 		return false;
 
 	//printf("mmap insert: upage %p\n");
@@ -88,8 +103,10 @@ mmap_insert (const void *vaddr, bool writable, struct file *file_p, int mapping,
 		PANIC ("page_insert: out of memory (s_page_entry)");
 
 	p->upage = vaddr;
-	p->tid = thread_current()->tid;
+	p->owner = thread_current();
 	p->is_swapped = true;
+	p->zero_mapped = false;
+	p->swap_slot = SWAP_SLOT_NONE;
 	p->file_p = file_p;
 	p->mapping = mapping;
 	p->page_idx = page_idx;
@@ -104,36 +121,39 @@ mmap_insert (const void *vaddr, bool writable, struct file *file_p, int mapping,
 }
 
 struct s_page_entry *
-page_lookup (const void *vaddr, tid_t tid)
+page_lookup (const void *vaddr, struct thread *t)
 {
 	if (pg_ofs(vaddr) != 0)
 		PANIC ("page_lookup: not page address");
-	struct thread *t = find_thread(tid);
+	if (t == NULL)
+		t = thread_current();
 
 	struct s_page_entry p;
 	struct hash_elem *e;
 	p.upage = vaddr;
 
 	lock_acquire_s_pt(t);
-	e = hash_find ((struct hash *)(find_thread(tid)->s_pt), &p.hash_elem);
+	e = hash_find ((struct hash *)(t->s_pt), &p.hash_elem);
 	lock_release_s_pt(t);
 	return e != NULL ? hash_entry(e, struct s_page_entry, hash_elem) : NULL;
 }
 
-void
+/* Unmaps ENTRY's page from its owner and returns whether it was
+   dirty.  The dirty bit is read only after the mapping is gone,
+   and pagedir_clear_page() keeps it in the PTE, so a write that
+   races with eviction is never mistaken for a clean page. */
+bool
 page_get_evicted(struct s_page_entry * entry)
 {
-	struct thread *t;
+	struct thread *t = entry->owner;
+	bool dirty;
 	entry->is_swapped = true;
 
-	t = find_thread(entry->tid);
-	if (t == NULL)
-		PANIC("page_get_evicted: invalid tid");
 	lock_acquire_pagedir(t);
-	pagedir_clear_page(t->pagedir, entry->upage);
+	pagedir_clear_page(t->pagedir, (void *) entry->upage);
+	dirty = pagedir_is_dirty(t->pagedir, entry->upage);
 	lock_release_pagedir(t);
-	//pagedir_set_dirty (t->pagedir, entry->upage, false);
-	//pagedir_set_accessed (t->pagedir, entry->upage, false);
+	return dirty;
 }
 
 void
@@ -151,58 +171,113 @@ page_swap_in (struct s_page_entry * entry, void *kpage)
 		PANIC ("page_swap_in: pagedir_set_page failed!");
 }
 
+/* Returns true if ENTRY's page, when not resident, is known to be
+   all zeros: an executable page with nothing to read and no copy
+   in swap. */
+bool
+page_is_zero_fill (struct s_page_entry *entry)
+{
+	return entry->is_swapped && entry->swap_slot == SWAP_SLOT_NONE
+		&& entry->file_p != NULL && entry->mapping < 0 && entry->page_read_bytes == 0;
+}
+
+/* Maps the shared zero frame read-only at ENTRY's page.  A write
+   to it faults and gets a private frame from page_unshare_zero(). */
+void
+page_map_zero (struct s_page_entry *entry)
+{
+	bool success;
+
+	entry->is_swapped = false;
+	entry->zero_mapped = true;
+	lock_acquire_pagedir(NULL);
+	success = pagedir_set_page(thread_current()->pagedir, (void *) entry->upage, frame_zero_page(), false);
+	lock_release_pagedir(NULL);
+	if (!success)
+		PANIC ("page_map_zero: pagedir_set_page failed!");
+}
+
+/* Replaces ENTRY's zero frame mapping with private frame KPAGE,
+   which must already be zeroed. */
+void
+page_unshare_zero (struct s_page_entry *entry, void *kpage)
+{
+	ASSERT (entry->zero_mapped);
+
+	lock_acquire_pagedir(NULL);
+	pagedir_clear_page(thread_current()->pagedir, (void *) entry->upage);
+	lock_release_pagedir(NULL);
+	entry->zero_mapped = false;
+	page_swap_in(entry, kpage);
+}
+
+/* Releases the swap slots still held by the pages in TABLE. */
 void
-remove_page_block_sector(struct hash *table)
+page_free_swap_slots (struct hash *table)
 {
 	struct hash_iterator itr;
-	struct hash_elem *e;
-	struct list_elem *_e;
 	struct s_page_entry *entry;
-	
-	hash_first (&itr, table);
-	e = itr.elem;
-	while (e != NULL) {
-			entry = hash_entry(e, struct s_page_entry, hash_elem);
-
-			if (entry->is_swapped && (entry->file_p == NULL || entry->mapping < 0)){
-				for (_e = list_begin(&entry->sector_list); _e != list_end(&entry->sector_list); _e = list_next(_e)){
-					remove_swap_entry(list_entry(_e, struct swap_entry, list_elem)->sector);
-				}
-			}
 
-			e = hash_next(&itr);
+	hash_first (&itr, table);
+	while (hash_next (&itr)) {
+		entry = hash_entry(hash_cur (&itr), struct s_page_entry, hash_elem);
+		if (entry->swap_slot != SWAP_SLOT_NONE) {
+			swap_free(entry->swap_slot);
+			entry->swap_slot = SWAP_SLOT_NONE;
+		}
 	}
 }
 
+/* Removes mmap MAPPING of the current process, writing dirty
+   resident pages back and freeing their frames. */
 void
 unmap (int mapping)
 {
-	struct hash_elem *e;
+	struct thread *t = thread_current();
+	struct hash *s_pt = (struct hash *) t->s_pt;
 	struct hash_iterator itr;
-	struct s_page_entry *entry;
-	
-	lock_acquire_s_pt(thread_current());
-	hash_first(&itr, (struct hash *)thread_current()->s_pt);
-	e = itr.elem;
+	struct hash_elem *e;
+	struct s_page_entry *entry, p;
+	uint8_t *upage = NULL;
+	void *kpage;
 
-	while (e != NULL){
-		entry = hash_entry(e, struct s_page_entry, hash_elem);
+	lock_acquire_ft();
+	lock_acquire_s_pt(t);
 
+	/* A mapping's pages are contiguous, so find where it starts and
+	   then walk it page by page. */
+	hash_first(&itr, s_pt);
+	while (hash_next(&itr)) {
+		entry = hash_entry(hash_cur(&itr), struct s_page_entry, hash_elem);
 		if (entry->file_p != NULL && entry->mapping == mapping) {
-			if (!entry->is_swapped && pagedir_is_dirty(thread_current()->pagedir, entry->upage)) {
-				file_seek(entry->file_p, entry->page_idx * PGSIZE);
-				file_write(entry->file_p, entry->upage, entry->page_read_bytes);
-				file_seek(entry->file_p, 0);
-				page_get_evicted(entry);
-				remove_frame_entry (thread_current()->tid, entry->upage);
-			}
-			e = hash_next(&itr);
-			hash_delete((struct hash *)thread_current()->s_pt, &entry->hash_elem);
+			upage = (uint8_t *) entry->upage - entry->page_idx * PGSIZE;
+			break;
+		}
+	}
+
+	for (; upage != NULL; upage += PGSIZE) {
+		p.upage = upage;
+		e = hash_find(s_pt, &p.hash_elem);
+		if (e == NULL)
+			break;
+		entry = hash_entry(e, struct s_page_entry, hash_elem);
+		if (entry->file_p == NULL || entry->mapping != mapping)
+			break;
+
+		if (!entry->is_swapped) {
+			kpage = pagedir_get_page(t->pagedir, upage);
+			remove_frame_entry(t, upage);
+			if (page_get_evicted(entry))
+				file_write_at(entry->file_p, kpage, entry->page_read_bytes, entry->page_idx * PGSIZE);
+			palloc_free_page(kpage);
 		}
-		else
-			e = hash_next(&itr);
+		hash_delete(s_pt, &entry->hash_elem);
+		file_close(entry->file_p);
+		free(entry);
 	}
-	lock_release_s_pt(thread_current());
+
+	lock_release_s_pt(t);
+	lock_release_ft();
 }
 
 void
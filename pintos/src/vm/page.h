@@ -9,36 +9,35 @@
 struct s_page_entry
 {
 	struct hash_elem hash_elem;
-	tid_t tid;
+	struct thread *owner;				/* Process whose address space holds it. */
 	const void *upage;
 	bool is_swapped;
 	bool writable;
+	bool zero_mapped;						/* Mapped read-only to the zero frame. */
 
-	/* segment page entry */
-	struct list sector_list;
+	/* swap slot holding a copy of the page, kept across swap-in */
+	size_t swap_slot;
 
-	/* mmap page entry */
+	/* file-backed page: mmap (mapping >= 0) or executable segment */
 	struct file * file_p;
 	int mapping;
 	size_t page_idx;
 	size_t page_read_bytes;
 };
 
-struct sector_elem
-{
-	struct list_elem list_elem;
-	block_sector_t sector;
-};
-
 uint32_t *s_page_table_create (void);
 void s_page_table_destroy (uint32_t *);
 
 void page_insert (const void *, bool);
-struct s_page_entry *page_lookup (const void *, tid_t);
+struct s_page_entry *page_lookup (const void *, struct thread *);
 void page_swap_in (struct s_page_entry *, void *);
-void remove_page_block_sector(struct hash *);
-void page_get_evicted(struct s_page_entry *);
+void page_free_swap_slots (struct hash *);
+bool page_get_evicted(struct s_page_entry *);
+bool page_is_zero_fill (struct s_page_entry *);
+void page_map_zero (struct s_page_entry *);
+void page_unshare_zero (struct s_page_entry *, void *);
 
+bool segment_insert (const void *, bool, struct file *, off_t, size_t);
 bool mmap_insert (const void *, bool, struct file *, int, size_t, size_t);
 void unmap(int);
 
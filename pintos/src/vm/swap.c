@@ -1,4 +1,6 @@
 #include <string.h>
+#include <bitmap.h>
+#include <debug.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
@@ -8,137 +10,158 @@
 #include "vm/swap.h"
 #include "vm/frame.h"
 
+/* Swap space is carved into page-sized slots of SWAP_SLOT_SECTORS
+   contiguous sectors.  Free slots are kept on a stack, so taking
+   and returning a slot are both O(1); USED catches double frees. */
 struct swap_table
 {
 	struct lock lock;
-	struct list entry_list;
+	size_t slot_cnt;
+	size_t *free_slots;
+	size_t free_cnt;
+	struct bitmap *used;
 };
 
 struct swap_table *swap_t;
 struct block *swap_block;
 
-block_sector_t find_free_sector(void);
-
-bool swap_list_less(const struct list_elem *, const struct list_elem *, void *);
+static size_t swap_slot_alloc (void);
 
 void
 swap_table_init()
 {
+	size_t i;
+
 	swap_t = malloc(sizeof(struct swap_table));
 	if (swap_t == NULL)
 		PANIC ("swap_table_init: memory allocation failed (swap_t)");
 
 	lock_init(&swap_t->lock);
-	list_init(&swap_t->entry_list);
 
 	swap_block = block_get_role(BLOCK_SWAP);
+	swap_t->slot_cnt = swap_block != NULL ? block_size(swap_block) / SWAP_SLOT_SECTORS : 0;
+
+	swap_t->free_cnt = 0;
+	if (swap_t->slot_cnt == 0)
+		return;
+
+	swap_t->used = bitmap_create(swap_t->slot_cnt);
+	swap_t->free_slots = malloc(swap_t->slot_cnt * sizeof(size_t));
+	if (swap_t->used == NULL || swap_t->free_slots == NULL)
+		PANIC ("swap_table_init: memory allocation failed (%zu slots)", swap_t->slot_cnt);
+
+	/* Push in reverse so that low slots are handed out first. */
+	for (i = 0; i < swap_t->slot_cnt; i++)
+		swap_t->free_slots[i] = swap_t->slot_cnt - 1 - i;
+	swap_t->free_cnt = swap_t->slot_cnt;
 }
 
-block_sector_t
-swap_out (void *buffer)
+/* Takes a free slot off the stack.  Panics if swap is full. */
+static size_t
+swap_slot_alloc()
 {
-	struct swap_entry *entry;
-	entry = malloc(sizeof(struct swap_entry));
-	
-	if (entry == NULL)
-		PANIC("swap_out: out of memory (swap_entry)");
+	size_t slot;
 
-	//printf("swap out buffer %p\n", buffer);
 	lock_acquire_sw();
-	entry->sector = find_free_sector();
-
-	list_insert_ordered(&swap_t->entry_list, &entry->list_elem, swap_list_less, NULL);
+	if (swap_t->free_cnt == 0)
+		PANIC ("swap_slot_alloc: out of swap slots");
+	slot = swap_t->free_slots[--swap_t->free_cnt];
+	bitmap_mark(swap_t->used, slot);
 	lock_release_sw();
-	
-	block_write (swap_block, entry->sector, buffer);
 
-	return entry->sector;
+	return slot;
 }
 
+/* Returns SLOT to the free stack. */
 void
-swap_in (struct s_page_entry *s_pte, void * upage)
+swap_free (size_t slot)
 {
-	void *kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-	int cnt = PGSIZE / BLOCK_SECTOR_SIZE, i;
-	block_sector_t sector;
-
-	if (kpage == NULL)
-		kpage = frame_evict();
-
-	//printf("swap in buffer %p tid %d upage: %p\n", kpage, thread_current()->tid, upage);
-	if (s_pte->file_p == NULL) {
-		for(i = 0; i < cnt; i++){
-			sector = list_entry(list_pop_front(&s_pte->sector_list), struct sector_elem, list_elem)->sector;
-			remove_swap_entry(sector);
-			block_read (swap_block, sector, kpage + i*BLOCK_SECTOR_SIZE);
-		}
-		page_swap_in(s_pte, kpage);
-		set_frame_entry(upage, kpage);
-		//printf("swap_in finish\n");
-	}
-	else {
-		//void * temp = (void *)s_pte->file_p;
-		//while (s_pte != NULL && (void *)s_pte->file_p == temp && kpage != NULL) {
-			//printf("swap in: tid %d upage %p kpage %p\n", thread_current()->tid, s_pte->upage, kpage);
-
-			file_read_at(s_pte->file_p, kpage, s_pte->page_read_bytes, s_pte->page_idx * PGSIZE);
-			//printf("thread %d page_read_bytes: %d\n", thread_current()->tid, s_pte->page_read_bytes);
-			if (s_pte->page_read_bytes == PGSIZE)
-				file_seek(s_pte->file_p, PGSIZE);
-			else {
-				memset (kpage + s_pte->page_read_bytes, 0, PGSIZE - s_pte->page_read_bytes);
-				file_seek(s_pte->file_p, 0);
-			}
-
-			page_swap_in (s_pte, kpage);
-			set_frame_entry (s_pte->upage, kpage);
-			//kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-			//if (kpage == NULL)
-				//kpage = frame_evict();
-
-			//s_pte = page_lookup ((s_pte->upage)+PGSIZE, thread_current()->tid);
-		//}
-		//file_seek(temp, 0);
-	}
+	lock_acquire_sw();
+	ASSERT (slot < swap_t->slot_cnt);
+	ASSERT (bitmap_test(swap_t->used, slot));
+	bitmap_reset(swap_t->used, slot);
+	swap_t->free_slots[swap_t->free_cnt++] = slot;
+	lock_release_sw();
 }
 
+/* Writes the page at KPAGE to S_PTE's swap slot with a single
+   multi-sector transfer, allocating the slot on first use. */
 void
-remove_swap_entry (block_sector_t sector)
+swap_out (struct s_page_entry *s_pte, void *kpage)
 {
-	struct list *l = &swap_t->entry_list;
-	struct list_elem *e;
+	if (s_pte->swap_slot == SWAP_SLOT_NONE)
+		s_pte->swap_slot = swap_slot_alloc();
 
-	lock_acquire_sw();
-	for (e = list_begin(l); e != list_end(l); e = list_next(e)){
-		if (list_entry(e, struct swap_entry, list_elem)->sector == sector){
-			list_remove(e);
-			break;
-		}
+	block_write_multiple (swap_block, s_pte->swap_slot * SWAP_SLOT_SECTORS, kpage, SWAP_SLOT_SECTORS);
+}
+
+/* Fills KPAGE with S_PTE's page, from its swap slot if it has one
+   and otherwise from its file, and maps it. */
+static void
+swap_fill (struct s_page_entry *s_pte, void *kpage)
+{
+	if (s_pte->swap_slot != SWAP_SLOT_NONE)
+		block_read_multiple (swap_block, s_pte->swap_slot * SWAP_SLOT_SECTORS, kpage, SWAP_SLOT_SECTORS);
+	else if (s_pte->file_p != NULL) {
+		file_read_at(s_pte->file_p, kpage, s_pte->page_read_bytes, s_pte->page_idx * PGSIZE);
+		memset (kpage + s_pte->page_read_bytes, 0, PGSIZE - s_pte->page_read_bytes);
 	}
-	lock_release_sw();
+	else
+		memset (kpage, 0, PGSIZE);
 
+	page_swap_in(s_pte, kpage);
+	set_frame_entry((void *) s_pte->upage, kpage);
+	if (!s_pte->writable)
+		frame_share_add(s_pte, kpage);
 }
 
-block_sector_t
-find_free_sector()
+/* Brings S_PTE's page back into a frame.  Read-only executable
+   pages are mapped from another process's frame when one exists.
+   A swap slot stays allocated, so the page can be dropped again
+   without I/O while it is clean.  The caller must hold the frame
+   table lock. */
+void
+swap_in (struct s_page_entry *s_pte, void * upage UNUSED)
 {
-	struct list_elem *e;
-	block_sector_t candidate = 0;
-	struct list *l = &swap_t->entry_list;
-
-
-	if (!list_empty(l)) {
-		for (e = list_begin(l); e != list_end (l); e = list_next(e)){
-			struct swap_entry *entry = list_entry(e, struct swap_entry, list_elem);
-			if (entry->sector == candidate)
-				candidate += 1;
-			else
-				break;
-		}
-	}
+	if (frame_share_in(s_pte))
+		return;
 
+	swap_fill(s_pte, frame_get_page(false));
+}
 
-	return candidate;
+/* Maps the non-resident neighbours of file-backed page S_PTE that
+   lie in the same aligned window of FAULT_AROUND_PAGES pages and
+   the same mapping, so that sequential access takes one fault per
+   window.  Neighbours are only brought in while that is cheap:
+   from a shared frame, or from the file into a free frame.  Nothing
+   is evicted for them.  The caller must hold the frame table
+   lock. */
+void
+swap_in_around (struct s_page_entry *s_pte)
+{
+	uint8_t *start = (uint8_t *) ((uintptr_t) s_pte->upage & ~(FAULT_AROUND_PAGES * PGSIZE - 1));
+	struct s_page_entry *n;
+	void *kpage;
+	int i;
+
+	if (s_pte->file_p == NULL)
+		return;
+
+	for (i = 0; i < FAULT_AROUND_PAGES; i++) {
+		if (start + i*PGSIZE == s_pte->upage || !is_user_vaddr(start + i*PGSIZE))
+			continue;
+		n = page_lookup(start + i*PGSIZE, NULL);
+		if (n == NULL || !n->is_swapped || n->file_p == NULL || n->mapping != s_pte->mapping
+				|| n->swap_slot != SWAP_SLOT_NONE || page_is_zero_fill(n))
+			continue;
+
+		if (frame_share_in(n))
+			continue;
+		kpage = palloc_get_page(PAL_USER);
+		if (kpage == NULL)
+			break;
+		swap_fill(n, kpage);
+	}
 }
 
 void
@@ -151,12 +174,3 @@ void lock_release_sw()
 {
 	lock_release(&swap_t->lock);
 }
-
-bool
-swap_list_less(const struct list_elem *a, const struct list_elem *b, void *aux)
-{
-	const struct swap_entry *_a = list_entry(a, struct swap_entry, list_elem);
-	const struct swap_entry *_b = list_entry(b, struct swap_entry, list_elem);
-
-	return _a->sector < _b->sector;
-}
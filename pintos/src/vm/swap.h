@@ -1,17 +1,22 @@
-#include <list.h>
+#include <stddef.h>
 #include "devices/block.h"
+#include "threads/vaddr.h"
 #include "vm/page.h"
 
-struct swap_entry
-{
-	struct list_elem list_elem;
-	block_sector_t sector;
-};
+/* Number of swap sectors backing one page. */
+#define SWAP_SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Size of the aligned window mapped around a file-backed fault. */
+#define FAULT_AROUND_PAGES 8
+
+/* Slot index meaning "not in swap". */
+#define SWAP_SLOT_NONE ((size_t) -1)
 
 void swap_table_init(void);
-block_sector_t swap_out (void *);
+void swap_out (struct s_page_entry *, void *);
 void swap_in (struct s_page_entry *, void *);
-void remove_swap_entry (block_sector_t);
+void swap_in_around (struct s_page_entry *);
+void swap_free (size_t);
 
 void lock_acquire_sw(void);
 void lock_release_sw(void);